@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "patterns.hpp"
+
+// Where the pointees come from.
+//
+// The sequential-indirect pattern's pointers all point into one contiguous
+// array, which is the best case for indirection. In real code, each object
+// tends to be allocated on its own, in between allocations of everything else.
+// These patterns make the same sequence of allocations (one int, then some
+// other object of a random size, over and over) with three different
+// allocators, and walk the ints in the order they were allocated:
+//
+// - malloc-indirect gets each one from malloc(), which puts headers between
+//   them and the other objects wherever they fit.
+// - arena-indirect bumps a pointer through big blocks, so the ints are packed
+//   in among the other objects, with nothing else in between.
+// - pool-indirect gives each size class a bump arena of its own,
+//   so all the ints end up together in their own pool.
+//
+// Making one allocation at a time is slow, and malloc-indirect's take up
+// several times as much memory as what we asked for, so these make one int
+// for every 64 bytes of the data set (copying in its value before each run).
+
+namespace detail {
+
+// The other objects' sizes, from 8 to 256 bytes.
+// The seed is fixed so that every run (and every allocator) gets the same ones.
+class FillerSizes {
+public:
+	size_t next() { return sizes(engine) * 8; }
+
+private:
+	std::minstd_rand engine{12345};
+	std::uniform_int_distribution<size_t> sizes{1, 32};
+};
+
+// Hands out memory by bumping a pointer through blocks of at least 1 MiB.
+// Each block is all of whatever PageAllocator mapped for it, so with huge pages,
+// a block is a whole huge page (or more), instead of a megabyte of one.
+// Nothing is freed until the arena is.
+class BumpArena {
+public:
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+	{
+		size_t start = blocks.empty() ? 0 : (blocks.back().used + alignment - 1) & ~(alignment - 1);
+		if (blocks.empty() || start + bytes > blocks.back().size) {
+			const size_t wanted = std::max(bytes, minBlockSize);
+			uint8_t* p = PageAllocator<uint8_t>().allocate(wanted);
+			blocks.push_back({std::unique_ptr<uint8_t, Unmap>(p), mappedBytes(p, wanted), 0});
+			start = 0;
+		}
+		Block& b = blocks.back();
+		b.used = start + bytes;
+		return b.data.get() + start;
+	}
+
+	// Just the parts of each block we've handed out
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		for (const auto& b : blocks)
+			out.push_back({b.data.get(), b.used});
+	}
+
+	// Which are all ours
+	void ownedRegions(std::vector<MemoryRegion>& out) const { regions(out); }
+
+private:
+	static constexpr size_t minBlockSize = 1024 * 1024;
+
+	struct Unmap {
+		void operator()(uint8_t* p) const { PageAllocator<uint8_t>().deallocate(p, 0); }
+	};
+
+	struct Block {
+		std::unique_ptr<uint8_t, Unmap> data;
+		size_t size; // In bytes
+		size_t used;
+	};
+
+	std::vector<Block> blocks;
+};
+
+// A bump arena per power-of-two size class, from 4 bytes up
+class SizeClassPools {
+public:
+	void* allocate(size_t bytes)
+	{
+		size_t c = 0;
+		while (((size_t)4 << c) < bytes)
+			++c;
+		if (c >= pools.size())
+			pools.resize(c + 1);
+		const size_t classSize = (size_t)4 << c;
+		return pools[c].allocate(classSize, std::min<size_t>(classSize, alignof(std::max_align_t)));
+	}
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		for (const auto& p : pools)
+			p.regions(out);
+	}
+
+	void ownedRegions(std::vector<MemoryRegion>& out) const { regions(out); }
+
+private:
+	std::vector<BumpArena> pools;
+};
+
+// What we ask malloc() for, kept so we can give it back
+class MallocHeap {
+public:
+	MallocHeap() = default;
+	MallocHeap(const MallocHeap&) = delete;
+	MallocHeap& operator=(const MallocHeap&) = delete;
+
+	~MallocHeap()
+	{
+		for (const auto& a : allocations)
+			std::free(const_cast<void*>(a.start));
+	}
+
+	void* allocate(size_t bytes)
+	{
+		void* p = std::malloc(bytes);
+		if (p == nullptr)
+			throw std::bad_alloc();
+		allocations.push_back({p, bytes});
+		return p;
+	}
+
+	// The cache lines our allocations are on, with lines that touch merged.
+	// That's usually one region for a whole run of allocations, where one per
+	// allocation would be millions of them (most of which don't fill a line).
+	// Lines we share with malloc()'s headers (or whatever else it put there)
+	// are readable, so clflush doesn't mind flushing them too.
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		std::vector<MemoryRegion> sorted = allocations;
+		std::sort(sorted.begin(), sorted.end(),
+			[](const MemoryRegion& a, const MemoryRegion& b) { return a.start < b.start; });
+
+		const uintptr_t line = 64;
+		const size_t first = out.size();
+		for (const auto& a : sorted) {
+			const uintptr_t start = (uintptr_t)a.start & ~(line - 1);
+			const uintptr_t end = ((uintptr_t)a.start + a.size + line - 1) & ~(line - 1);
+			if (out.size() > first) {
+				MemoryRegion& last = out.back();
+				const uintptr_t lastEnd = (uintptr_t)last.start + last.size;
+				if (start <= lastEnd) {
+					last.size = std::max(lastEnd, end) - (uintptr_t)last.start;
+					continue;
+				}
+			}
+			out.push_back({(const void*)start, end - start});
+		}
+	}
+
+	// Just the bytes we asked for, since the ones in between aren't ours to write
+	void ownedRegions(std::vector<MemoryRegion>& out) const
+	{
+		out.insert(out.end(), allocations.begin(), allocations.end());
+	}
+
+private:
+	std::vector<MemoryRegion> allocations;
+};
+
+} // namespace detail
+
+// The sequential-indirect walk over ints from the given allocator,
+// which needs allocate(bytes), regions(out) (the memory to flush)
+// and ownedRegions(out) (just the bytes it handed out) members.
+template <typename Allocator>
+class AllocatedPattern : public IndirectPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		heap.reset(new Allocator);
+		detail::FillerSizes fillers;
+
+		pointers.resize(std::max<size_t>(1, d.size() * sizeof(int) / 64));
+		for (auto& p : pointers) {
+			p = (int*)heap->allocate(sizeof(int));
+			heap->allocate(fillers.next());
+		}
+
+		// These don't change, so find them once instead of before every run.
+		heapRegions.clear();
+		heap->regions(heapRegions);
+	}
+
+	void prepare(std::default_random_engine&) override
+	{
+		for (size_t i = 0; i < pointers.size(); ++i)
+			*pointers[i] = (*data)[i];
+	}
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		IndirectPattern::auxiliaryMemory(regions);
+		regions.insert(regions.end(), heapRegions.begin(), heapRegions.end());
+	}
+
+	void ownedMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		IndirectPattern::auxiliaryMemory(regions);
+		heap->ownedRegions(regions);
+	}
+
+private:
+	const DataSet* data = nullptr;
+	std::unique_ptr<Allocator> heap;
+	std::vector<MemoryRegion> heapRegions;
+};
+
+inline const RegisterPattern<AllocatedPattern<detail::MallocHeap>> registerMalloc(
+	"malloc-indirect", "Sequential-indirect, to ints malloc()ed among other objects");
+
+inline const RegisterPattern<AllocatedPattern<detail::BumpArena>> registerArena(
+	"arena-indirect", "Same, but allocated from a bump arena");
+
+inline const RegisterPattern<AllocatedPattern<detail::SizeClassPools>> registerPool(
+	"pool-indirect", "Same, but allocated from per-size-class pools");
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "patterns.hpp"
+#include "simd.hpp"
+
+// Memory bandwidth, STREAM-style: patterns that write as well as read.
+//
+// Everything else here only loads, but plenty of real code is limited
+// by how fast it can store, or copy from one place to another.
+// These walk the data set front to back like the contiguous pattern
+// (so for reads alone, see contiguous-simd), and:
+//
+// - write fills an array as big as the data set with a constant,
+// - read-modify-write adds one to every element of a copy of the data set,
+// - copy copies the data set into another array (and copy-memcpy does the same
+//   with memcpy(), whose own choice of stores is part of what it measures),
+// - triad does STREAM's a[i] = b[i] + 3 * c[i], with the data set as b.
+//
+// An ordinary store to a line that isn't in cache has to read it in first
+// (a "read for ownership"), so each byte written costs two bytes of traffic.
+// The -nt versions use non-temporal (streaming) stores instead, which write
+// whole lines straight to memory without reading them, or evicting anything
+// else from the cache to make room. Like STREAM, we only count the bytes the
+// code asks to move, so the ordinary versions' GB/s
+// come out lower by about the cost of those extra reads.
+//
+// The arrays these write to are their own, so the data set stays the same
+// for every other pattern. Their sumRange()s return how many elements they did,
+// since there's nothing to add up, so doWork() is always 1.
+
+namespace kernels {
+
+#ifdef CACHE_DEMO_X86
+
+// The loops below use SSE2 (which every x86-64 CPU has) for the ordinary stores
+// as well as the non-temporal ones, so the only difference between the two
+// is the store instruction. Left to itself, the compiler would turn
+// the plain write and copy loops into calls to memset() and memcpy().
+template <bool NonTemporal>
+inline void store4(int* p, __m128i v)
+{
+	if (NonTemporal)
+		_mm_stream_si128((__m128i*)p, v);
+	else
+		_mm_store_si128((__m128i*)p, v);
+}
+
+// Non-temporal stores have to be aligned, and so do the ordinary ones above,
+// so loops do elements one at a time until the destination is.
+inline size_t elementsToAlign(const int* p, size_t n)
+{
+	const size_t misaligned = ((uintptr_t)p / sizeof(int)) % 4;
+	return misaligned == 0 ? 0 : std::min(n, 4 - misaligned);
+}
+
+// Streaming stores aren't ordered with other stores,
+// so wait until they're out before we call the work done.
+template <bool NonTemporal>
+inline void finishStores()
+{
+	if (NonTemporal)
+		_mm_sfence();
+}
+
+template <bool NonTemporal>
+inline void writeInts(int* out, size_t n, int value)
+{
+	size_t i = elementsToAlign(out, n);
+	for (size_t j = 0; j < i; ++j)
+		out[j] = value;
+
+	const __m128i v = _mm_set1_epi32(value);
+	for (; i + 4 <= n; i += 4)
+		store4<NonTemporal>(out + i, v);
+	finishStores<NonTemporal>();
+
+	for (; i < n; ++i)
+		out[i] = value;
+}
+
+template <bool NonTemporal>
+inline void incrementInts(int* p, size_t n)
+{
+	size_t i = elementsToAlign(p, n);
+	for (size_t j = 0; j < i; ++j)
+		p[j] = (int)((unsigned)p[j] + 1);
+
+	const __m128i one = _mm_set1_epi32(1);
+	for (; i + 4 <= n; i += 4)
+		store4<NonTemporal>(p + i, _mm_add_epi32(_mm_load_si128((const __m128i*)(p + i)), one));
+	finishStores<NonTemporal>();
+
+	for (; i < n; ++i)
+		p[i] = (int)((unsigned)p[i] + 1);
+}
+
+template <bool NonTemporal>
+inline void copyInts(int* out, const int* in, size_t n)
+{
+	size_t i = elementsToAlign(out, n);
+	for (size_t j = 0; j < i; ++j)
+		out[j] = in[j];
+
+	for (; i + 4 <= n; i += 4)
+		store4<NonTemporal>(out + i, _mm_loadu_si128((const __m128i*)(in + i)));
+	finishStores<NonTemporal>();
+
+	for (; i < n; ++i)
+		out[i] = in[i];
+}
+
+// a[i] = b[i] + 3 * c[i] (SSE2 has no 32-bit multiply, but we only need a triple)
+template <bool NonTemporal>
+inline void triadInts(int* a, const int* b, const int* c, size_t n)
+{
+	size_t i = elementsToAlign(a, n);
+	for (size_t j = 0; j < i; ++j)
+		a[j] = b[j] + 3 * c[j];
+
+	for (; i + 4 <= n; i += 4) {
+		const __m128i cv = _mm_loadu_si128((const __m128i*)(c + i));
+		const __m128i tripled = _mm_add_epi32(cv, _mm_add_epi32(cv, cv));
+		store4<NonTemporal>(a + i, _mm_add_epi32(_mm_loadu_si128((const __m128i*)(b + i)), tripled));
+	}
+	finishStores<NonTemporal>();
+
+	for (; i < n; ++i)
+		a[i] = b[i] + 3 * c[i];
+}
+
+#else
+
+// Elsewhere, plain loops with ordinary stores (which the compiler is free
+// to vectorize, or to turn into memset() and memcpy()).
+// There's no portable way to ask for non-temporal ones.
+
+template <bool NonTemporal>
+inline void writeInts(int* out, size_t n, int value)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = value;
+}
+
+template <bool NonTemporal>
+inline void incrementInts(int* p, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		p[i] = (int)((unsigned)p[i] + 1);
+}
+
+template <bool NonTemporal>
+inline void copyInts(int* out, const int* in, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = in[i];
+}
+
+template <bool NonTemporal>
+inline void triadInts(int* a, const int* b, const int* c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		a[i] = b[i] + 3 * c[i];
+}
+
+#endif // CACHE_DEMO_X86
+
+} // namespace kernels
+
+// What a bandwidth pattern does with each element
+enum class BandwidthOp {
+	Write, // out[i] = constant
+	Update, // out[i] += 1, where out starts as a copy of the data set
+	Copy, // out[i] = data[i]
+	Memcpy, // The same, with memcpy()
+	Triad, // out[i] = data[i] + 3 * other[i], where other is another copy
+};
+
+template <BandwidthOp Op, bool NonTemporal>
+class BandwidthPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		out.resize(d.size());
+		if (Op == BandwidthOp::Triad)
+			other.resize(d.size());
+	}
+
+	void prepare(std::default_random_engine&) override
+	{
+		if (Op == BandwidthOp::Update)
+			std::copy(data->begin(), data->end(), out.begin());
+		else if (Op == BandwidthOp::Triad)
+			std::copy(data->begin(), data->end(), other.begin());
+	}
+
+	size_t size() const override { return data->size(); }
+
+	// Const, since it doesn't change anything the pattern is made of,
+	// only the values in the array it writes to.
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		int* o = const_cast<int*>(out.data()) + first;
+		const int* d = data->data() + first;
+		const size_t n = last - first;
+		switch (Op) {
+			case BandwidthOp::Write: kernels::writeInts<NonTemporal>(o, n, 7); break;
+			case BandwidthOp::Update: kernels::incrementInts<NonTemporal>(o, n); break;
+			case BandwidthOp::Copy: kernels::copyInts<NonTemporal>(o, d, n); break;
+			case BandwidthOp::Memcpy: memcpy(o, d, n * sizeof(int)); break;
+			case BandwidthOp::Triad: kernels::triadInts<NonTemporal>(o, d, other.data() + first, n); break;
+		}
+		return n;
+	}
+
+	// Bytes read plus bytes written, not counting reads for ownership
+	double bytesPerElement() const override
+	{
+		switch (Op) {
+			case BandwidthOp::Write: return sizeof(int);
+			case BandwidthOp::Triad: return 3 * sizeof(int);
+			default: return 2 * sizeof(int);
+		}
+	}
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({out.data(), out.size() * sizeof(int)});
+		if (!other.empty())
+			regions.push_back({other.data(), other.size() * sizeof(int)});
+	}
+
+private:
+	const DataSet* data = nullptr;
+	PagedVector<int> out;
+	PagedVector<int> other;
+};
+
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Write, false>> registerWrite(
+	"write", "Fill an array as big as the data set with a constant");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Update, false>> registerUpdate(
+	"read-modify-write", "Add one to every element of a copy of the data set");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Copy, false>> registerCopy(
+	"copy", "Copy the data set into another array");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Memcpy, false>> registerMemcpy(
+	"copy-memcpy", "Same, with memcpy()");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Triad, false>> registerTriad(
+	"triad", "STREAM's triad: a[i] = data[i] + 3 * c[i]");
+
+#ifdef CACHE_DEMO_X86
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Write, true>> registerWriteNT(
+	"write-nt", "Write, with non-temporal stores");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Update, true>> registerUpdateNT(
+	"read-modify-write-nt", "Read-modify-write, with non-temporal stores");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Copy, true>> registerCopyNT(
+	"copy-nt", "Copy, with non-temporal stores");
+inline const RegisterPattern<BandwidthPattern<BandwidthOp::Triad, true>> registerTriadNT(
+	"triad-nt", "Triad, with non-temporal stores");
+#endif
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "flush.hpp"
+#include "perf.hpp"
+#include "report.hpp"
+#include "stats.hpp"
+#include "timer.hpp"
+#include "topology.hpp"
+
+// Timing your own kernels the way we time the patterns.
+//
+// Everything cache-demo does around a pattern (flushing the cache first,
+// batching calls that are too quick for the timer, counting hardware events,
+// the statistics and the JSON/CSV output) works for any other code too:
+//
+//     std::vector<uint32_t> keys = ...;
+//     BTree tree(keys);
+//     std::vector<uint32_t> probes = ...;
+//     std::default_random_engine re;
+//
+//     BenchmarkResult r = Benchmark("btree-lookups")
+//         .memory(tree.nodes(), tree.bytes())
+//         .setup([&] { std::shuffle(probes.begin(), probes.end(), re); })
+//         .kernel([&] {
+//             size_t found = 0;
+//             for (uint32_t p : probes)
+//                 found += tree.contains(p);
+//             return found;
+//         })
+//         .elements(probes.size(), sizeof(uint32_t))
+//         .iterations(200)
+//         .run();
+//     printResult(std::cout, r);
+//
+// Each run calls setup() (untimed), flushes the cache (untimed),
+// then times batch calls to the kernel together.
+// Whatever the kernel returns is passed to doNotOptimize(),
+// so the compiler can't throw the work away as a dead store.
+// r.row is a ResultRow, so writeJSON(), writeCSV() and writeOpenMetrics()
+// (see report.hpp) take it as is, and compareToBaseline() can gate on it;
+// printHistogram(std::cout, r.row.callTimes) shows how the runs were spread.
+
+// Makes the compiler believe value is read, so it has to compute it,
+// without the cost of actually storing it anywhere (as writing to a volatile would).
+// With GCC and Clang, the empty asm takes value in a register or from memory,
+// whichever it's already in; the "memory" clobber also makes the compiler
+// finish any stores it's put off (and reload anything it's cached) around it.
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile char sink;
+	sink = *reinterpret_cast<const volatile char*>(&value);
+#endif
+}
+
+// Makes the compiler believe all of memory is read and written here,
+// so stores before it can't be dropped or moved past it.
+inline void clobberMemory()
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : : "memory");
+#else
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+namespace detail {
+
+// Calls f(), passing whatever it returns (if anything) to doNotOptimize().
+template <typename F>
+inline void callAndKeep(F& f)
+{
+	if constexpr (std::is_void<decltype(f())>::value)
+		f();
+	else
+		doNotOptimize(f());
+}
+
+} // namespace detail
+
+// Picks how many calls we need to time together
+// for the timer's resolution to be lost in the noise.
+// Each trial calls reset() (to flush the cache, say) first, untimed, just like a real run,
+// so this only batches calls that are quick even when the data is cold (i.e., small ones).
+template <typename Reset, typename Call>
+unsigned int chooseBatch(Reset&& reset, Call&& call)
+{
+	const Timer& t = timer();
+	const double target = 200 * t.resolutionNs();
+
+	double fastest = 0;
+	for (int trial = 0; trial < 3; ++trial) {
+		reset();
+		const uint64_t start = t.start();
+		detail::callAndKeep(call);
+		const double ns = t.nanoseconds(t.stop() - start);
+		if (trial == 0 || ns < fastest)
+			fastest = ns;
+	}
+
+	if (fastest >= target)
+		return 1;
+	return (unsigned int)std::min(std::ceil(target / std::max(fastest, 1.0)), 1e6);
+}
+
+// Times batch calls together, and returns nanoseconds per call.
+// If perf isn't null, its counters are running around the calls
+// (starting before the clock does and stopping after it,
+// so that the syscalls to start and stop them aren't timed).
+template <typename Call>
+double timeBatch(unsigned int batch, Call&& call, PerfCounters* perf = nullptr)
+{
+	const Timer& t = timer();
+	if (perf)
+		perf->start();
+	const uint64_t start = t.start();
+	for (unsigned int b = 0; b < batch; ++b)
+		detail::callAndKeep(call);
+	const uint64_t end = t.stop();
+	if (perf)
+		perf->stop();
+	return t.nanoseconds(end - start) / batch;
+}
+
+// What Benchmark::run() measured
+struct BenchmarkResult {
+	// The summary, along with everything else the reporting backends need
+	ResultRow row;
+	// How long each (non-warmup) run took, in nanoseconds per call, in the order they ran
+	std::vector<double> samples;
+	// If we were asked for hardware counters and couldn't have them, why not
+	std::string perfError;
+};
+
+class Benchmark {
+public:
+	explicit Benchmark(std::string name) : benchName(std::move(name)) {}
+
+	// Called before every run (warmup or not), untimed,
+	// to reset or reshuffle whatever the kernel works on.
+	Benchmark& setup(std::function<void()> f)
+	{
+		setupFn = std::move(f);
+		return *this;
+	}
+
+	// The code to time. It can return a result (which we keep from being
+	// optimized away) or nothing (in which case it's up to the kernel
+	// to make sure its work is visible, with doNotOptimize() or clobberMemory()).
+	template <typename F>
+	Benchmark& kernel(F f)
+	{
+		kernelFn = [f]() mutable { detail::callAndKeep(f); };
+		return *this;
+	}
+
+	// How we get the kernel's memory out of cache before each run
+	// (Clflush by default; None to time it warm).
+	Benchmark& flush(FlushMode m)
+	{
+		mode = m;
+		return *this;
+	}
+
+	// Memory the kernel touches, which is flushed before each run.
+	// Call it once for each block of memory.
+	// FlushMode::Stream writes to it (putting back what was there),
+	// so with that mode, it mustn't be read-only.
+	Benchmark& memory(const void* start, size_t bytes)
+	{
+		fixedRegions.push_back({start, bytes});
+		return *this;
+	}
+
+	// For memory that moves between runs (say, if setup() reallocates it),
+	// a callback to add the kernel's current memory to the list we flush.
+	Benchmark& memory(std::function<void(std::vector<MemoryRegion>&)> f)
+	{
+		regionsFn = std::move(f);
+		return *this;
+	}
+
+	// How many elements each call works on, and how many bytes of memory each one
+	// moves, for the per-element times, bandwidths and counter averages.
+	Benchmark& elements(size_t n, double bytesPerElement = 0)
+	{
+		if (n == 0)
+			throw std::invalid_argument("A benchmark needs at least one element");
+		elementCount = n;
+		elementBytes = bytesPerElement;
+		return *this;
+	}
+
+	Benchmark& iterations(unsigned int n)
+	{
+		if (n == 0)
+			throw std::invalid_argument("A benchmark needs at least one iteration");
+		iterationCount = n;
+		return *this;
+	}
+
+	// Untimed runs to make first
+	Benchmark& warmup(unsigned int n)
+	{
+		warmupCount = n;
+		return *this;
+	}
+
+	// Calls to time together in each run, or 0 (the default) to pick automatically
+	Benchmark& batch(unsigned int n)
+	{
+		batchSize = n;
+		return *this;
+	}
+
+	Benchmark& rejectOutliers(bool reject = true)
+	{
+		rejecting = reject;
+		return *this;
+	}
+
+	// Count cycles, cache misses, etc. around each run (see perf.hpp).
+	Benchmark& perf(bool count = true)
+	{
+		counting = count;
+		return *this;
+	}
+
+	// What the results are recorded as having run with
+	Benchmark& threads(size_t n)
+	{
+		threadCount = n;
+		return *this;
+	}
+
+	// Use this flusher instead of making our own (which means working out
+	// the cache topology, and with FlushMode::Copy, allocating its buffers).
+	// The flusher's mode is used in place of flush()'s.
+	Benchmark& flusher(CacheFlusher& f)
+	{
+		sharedFlusher = &f;
+		return *this;
+	}
+
+	const std::string& name() const { return benchName; }
+
+	BenchmarkResult run()
+	{
+		if (!kernelFn)
+			throw std::logic_error("The benchmark " + benchName + " has no kernel");
+
+		std::unique_ptr<CacheFlusher> ownFlusher;
+		CacheFlusher* f = sharedFlusher;
+		if (!f) {
+			const CacheTopology topology = detectCacheTopology();
+			ownFlusher.reset(new CacheFlusher(mode, topology, topology.totalDataSize()));
+			f = ownFlusher.get();
+		}
+
+		BenchmarkResult result;
+		std::unique_ptr<PerfCounters> counters;
+		if (counting) {
+			counters.reset(new PerfCounters);
+			result.perfError = counters->error();
+			if (!counters->available())
+				counters.reset();
+		}
+
+		std::vector<MemoryRegion> regions;
+		auto reset = [&] {
+			regions = fixedRegions;
+			if (regionsFn)
+				regionsFn(regions);
+			f->flush(regions);
+		};
+
+		result.samples.resize(iterationCount);
+		std::vector<double> counts;
+		unsigned int b = batchSize;
+		for (unsigned int i = 0; i < warmupCount + iterationCount; ++i) {
+			if (setupFn)
+				setupFn();
+			if (b == 0)
+				b = chooseBatch(reset, kernelFn);
+			reset();
+			const bool warmingUp = i < warmupCount;
+			const double ns = timeBatch(b, kernelFn, warmingUp ? nullptr : counters.get());
+			if (!warmingUp) {
+				result.samples[i - warmupCount] = ns;
+				result.row.callTimes.recordNs(ns);
+				if (counters)
+					counters->addTo(counts);
+			}
+		}
+
+		ResultRow& row = result.row;
+		row.pattern = benchName;
+		row.elements = elementCount;
+		row.threads = threadCount;
+		row.batch = b;
+		row.bytesPerElement = elementBytes;
+		for (const auto& r : fixedRegions)
+			row.dataBytes += r.size;
+		if (regionsFn) {
+			regions.clear();
+			regionsFn(regions);
+			for (const auto& r : regions)
+				row.dataBytes += r.size;
+		}
+		// (summarize() sorts what it's given, so give it a copy.)
+		std::vector<double> sorted = result.samples;
+		row.summary = summarize(sorted, rejecting);
+		if (counters) {
+			const double perElement = (double)elementCount * iterationCount * b;
+			for (size_t i = 0; i < counts.size(); ++i)
+				row.counts.emplace_back(perfEvents()[counters->events()[i]].name, counts[i] / perElement);
+		}
+		return result;
+	}
+
+private:
+	std::string benchName;
+	std::function<void()> setupFn;
+	std::function<void()> kernelFn;
+	std::vector<MemoryRegion> fixedRegions;
+	std::function<void(std::vector<MemoryRegion>&)> regionsFn;
+	FlushMode mode = FlushMode::Clflush;
+	CacheFlusher* sharedFlusher = nullptr;
+	size_t elementCount = 1;
+	double elementBytes = 0;
+	unsigned int iterationCount = 1000;
+	unsigned int warmupCount = 0;
+	unsigned int batchSize = 0;
+	bool rejecting = false;
+	bool counting = false;
+	size_t threadCount = 1;
+};
+
+// Prints a result the way cache-demo prints a pattern's:
+// the median per call and per element, the spread, and any counters.
+inline void printResult(std::ostream& out, const BenchmarkResult& r)
+{
+	const ResultRow& row = r.row;
+	const Summary& s = row.summary;
+	out << row.pattern << ": " << formatTime(s.median) << " per call ("
+	    << formatTime(row.nsPerElement()) << " per element";
+	if (row.bytesPerElement > 0)
+		out << ", " << std::setprecision(3) << row.gbPerSecond() << " GB/s";
+	out << ")\n";
+	out << "  min " << formatTime(s.min) << ", p90 " << formatTime(s.p90)
+	    << ", p99 " << formatTime(s.p99) << ", max " << formatTime(s.max)
+	    << "; mean " << formatTime(s.mean) << " ± " << formatTime(s.ci95)
+	    << " over " << s.count << " runs of " << row.batch << " call" << (row.batch == 1 ? "" : "s");
+	if (s.outliers > 0)
+		out << " (" << s.outliers << " outlier" << (s.outliers == 1 ? "" : "s")
+		    << (s.outliersRejected ? " rejected)" : ")");
+	out << "\n";
+	if (!row.counts.empty()) {
+		out << "  per element:";
+		for (size_t i = 0; i < row.counts.size(); ++i)
+			out << (i == 0 ? " " : ", ") << std::setprecision(3) << row.counts[i].second << " "
+			    << row.counts[i].first;
+		out << "\n";
+	}
+	if (!r.perfError.empty())
+		out << "  (" << r.perfError << ")\n";
+}
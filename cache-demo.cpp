@@ -0,0 +1,1613 @@
+// A demonstration of how much memory layout matters to the CPU cache.
+//
+// Each access pattern (see patterns.hpp) does the same "work" over the same data,
+// but walks memory in a different way. We time all of them in one run,
+// against the same data and the same cache state, so they can be compared directly.
+//
+// Build with something like:
+//
+//     g++ -std=c++17 -O2 -pthread -o cache-demo cache-demo.cpp
+//
+// (Add -DCACHE_DEMO_FLAGS="\"-O2 ...\"" to record the flags you used in --output's results.)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cctype>
+#include <cstdint> // For standard int types
+#include <cstring> // For memcpy
+
+#include "alloc.hpp"
+#include "bandwidth.hpp"
+#include "benchmark.hpp"
+#include "chase.hpp"
+#include "compressed.hpp"
+#include "file.hpp"
+#include "flush.hpp"
+#include "gather.hpp"
+#include "histogram.hpp"
+#include "interleave.hpp"
+#include "isolation.hpp"
+#include "layout.hpp"
+#include "memory.hpp"
+#include "numa.hpp"
+#include "patterns.hpp"
+#include "perf.hpp"
+#include "prefetch.hpp"
+#include "report.hpp"
+#include "rng.hpp"
+#include "search.hpp"
+#include "sharing.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
+#include "threads.hpp"
+#include "tiled.hpp"
+#include "timer.hpp"
+#include "topology.hpp"
+#include "typed.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Populates each integer in the given data set with random numbers
+// derived from the given key (see rng.hpp).
+// Since the "work" we are doing is squaring each integer,
+// initialize them with some value between 1 and 10,
+// well clear of the square root of the integer max.
+void populateDataSet(DataSet& data, uint64_t key)
+{
+	fillRandomParallel(data.data(), data.size(), key, 1, 10);
+	data.key = key;
+}
+
+// Command-line options. Everything has a default,
+// so running with no arguments times every registered pattern.
+struct Options {
+	unsigned int iterations = 1000; // Number of tests to run
+	bool iterationsSet = false; // If not, --file runs fewer
+	unsigned int warmup = 0; // Number of untimed runs to make first
+	unsigned int batch = 0; // Calls to time together in each run, or 0 to pick automatically
+	unsigned int regenerate = 1; // Repopulate the data (and reshuffle) every this many iterations
+	bool rejectOutliers = false; // Exclude outliers from the statistics
+	bool seedSet = false; // If not, we seed from random_device
+	unsigned long seed = 0; // Seeds everything random about the run
+	string permCache; // Where to cache shuffles (see permutations.hpp), or empty for nowhere
+	vector<string> patterns; // Which patterns to run. Empty means all of them.
+
+	// These default to zero, which means "work it out from the cache topology".
+	size_t cacheSize = 0; // How much memory to copy to clear the cache (with --flush=copy)
+	size_t dataSize = 0; // The size of the data set, in bytes
+
+	// How we get the data out of cache before each run
+	FlushMode flush = FlushMode::Clflush;
+
+	// Knobs for individual patterns
+	PatternParams params;
+	bool tileSizeSet = false; // If not, it's worked out from the cache topology
+
+	// How many threads split up each pattern's work (see threads.hpp)
+	size_t threads = 1;
+	// Time each pattern with 1, 2, 4, ... threads (see runScaling())
+	bool scaling = false;
+
+	// Where the data set and each pattern's own memory (pointers, etc.) live
+	NumaPlacement dataPlacement;
+	NumaPlacement auxPlacement;
+	bool auxPlacementSet = false; // If not, it follows the data set
+	int cpuNode = -1; // Which node's CPUs to run on, or -1 for any
+	bool numaMatrix = false; // Time every CPU node against every memory node
+
+	// Count cycles, cache misses, etc. around each run (see perf.hpp)
+	bool perf = false;
+
+	// Keeping the timed thread's surroundings still (see isolation.hpp)
+	int pinCpu = -1; // Which CPU to pin the timed thread to, or -1 for any
+	bool raisePriority = false;
+	bool frequency = false; // Report the clock each pattern ran at
+	NoiseKind smtNoise = NoiseKind::None; // What to run on the timed CPU's SMT sibling
+
+	// What kind of pages back the data set and the patterns' arrays
+	PageMode pages = PageMode::Small;
+	bool pageCompare = false; // Time with small pages, then with the pages above
+
+	// Prefetch distance sweep (see runPrefetchSweep())
+	bool prefetchSweep = false;
+	size_t prefetchMax = 512; // The largest distance to try
+
+	// Interleaved lookup group size sweep (see runGroupSweep())
+	bool groupSweep = false;
+	size_t groupMax = 64; // The largest group to try
+
+	// Working set sweep (see runSweep()), or just of the search patterns (see runSearchSweep())
+	bool sweep = false;
+	bool searchSweep = false;
+	size_t sweepMin = 4 * 1024; // Smallest data set, in bytes
+	size_t sweepMax = 1024 * 1024 * 1024; // Largest data set, in bytes
+	double sweepStep = 2; // Each data set is this many times bigger than the last
+
+	// A data file to read instead of (or as well as) the data set (see file.hpp)
+	string file;
+	FileAdvice fileAdvice = FileAdvice::Normal;
+	size_t fileChunk = 1024 * 1024;
+
+	// Machine-readable results (see report.hpp)
+	string output; // Where to write them, if anywhere
+	string format = "json"; // json, csv, or openmetrics
+	string baseline; // Results to compare against, if any
+	double threshold = 0.05; // How much slower than the baseline counts as a regression
+	bool quiet = false; // Don't print progress between runs
+
+	// Latency histograms (see histogram.hpp)
+	bool histogram = false; // Chart each pattern's run times
+	size_t histogramChunk = 0; // Also time every this many elements, or 0 not to
+
+	bool list = false; // Just list the patterns and exit
+	bool help = false;
+};
+
+void printUsage(const char* argv0)
+{
+	cerr << "Usage: " << argv0 << " [options]\n"
+	     << "  --iterations=N     Number of runs per pattern (default 1000)\n"
+	     << "  --warmup=N         Number of runs to throw out before timing (default 0)\n"
+	     << "  --batch=N          Time N calls together per run (default: enough to swamp\n"
+	     << "                       the timer's resolution; only the first call is cold)\n"
+	     << "  --regenerate=N     Repopulate the data set and reshuffle only every N runs\n"
+	     << "                       (default 1; raise it to spend less time on bookkeeping)\n"
+	     << "  --reject-outliers  Exclude outliers (by Tukey's fences) from the statistics\n"
+	     << "  --seed=N           Seed the run, for repeatable data and shuffles (default: random)\n"
+	     << "  --perm-cache=DIR   Reuse a few shuffles of each size, saved in DIR, instead of\n"
+	     << "                       making new ones (up to 4 files per size and kind, each\n"
+	     << "                       4 bytes per element)\n"
+	     << "  --patterns=A,B,... Comma-separated list of patterns to run (default: all)\n"
+	     << "  --flush=MODE       How to get the data out of cache before each run:\n"
+	     << "                       clflush: flush the data's cache lines (default)\n"
+	     << "                       stream:  rewrite the data (in place) with non-temporal stores\n"
+	     << "                       l2:      evict the data from L1 and L2, but not L3\n"
+	     << "                       copy:    copy a buffer as big as the caches\n"
+	     << "                       none:    don't; measure with a warm cache\n"
+	     << "  --cache-size=SIZE  Total cache size to copy with --flush=copy (default: detected)\n"
+	     << "  --data-size=SIZE   Size of the data set (default: 10x the last level cache)\n"
+	     << "  --threads=N        Split each run between N pinned threads (default 1)\n"
+	     << "  --scaling          Time each pattern with 1, 2, 4, ... threads, up to one per CPU\n"
+	     << "  --data-node=N      Put the data set on NUMA node N\n"
+	     << "  --pointer-node=N   Put patterns' pointers (and indices) on node N\n"
+	     << "                       (default: wherever the data set is)\n"
+	     << "  --interleave       Interleave the data set (and pointers) across all nodes\n"
+	     << "  --cpu-node=N       Run on node N's CPUs\n"
+	     << "  --numa-matrix      Time each pattern from every node's CPUs to every node's memory\n"
+	     << "  --perf             Count cycles, instructions, and cache and TLB misses per element\n"
+	     << "  --pin-cpu=N        Pin the timed thread to CPU N (other threads get the CPUs after it)\n"
+	     << "  --raise-priority   Run as SCHED_FIFO if we can, or at the lowest nice value we can\n"
+	     << "  --frequency        Report the clock each pattern ran at (from APERF/MPERF or perf)\n"
+	     << "  --smt-noise=KIND   Run a busy thread on the timed CPU's SMT sibling:\n"
+	     << "                       alu:    integer multiplies\n"
+	     << "                       memory: streaming through twice the size of L2\n"
+	     << "  --pages=MODE       What kind of pages to back memory with:\n"
+	     << "                       4k:  regular pages (default)\n"
+	     << "                       thp: transparent huge pages\n"
+	     << "                       2m:  2M pages from the hugetlb pool\n"
+	     << "                       1g:  1G pages from the hugetlb pool\n"
+	     << "  --page-compare     Time each pattern with 4k pages and with --pages (default 2m)\n"
+	     << "  --sweep            Time each pattern over a range of data set sizes\n"
+	     << "  --sweep-min=SIZE   Smallest data set for --sweep (default 4K)\n"
+	     << "  --sweep-max=SIZE   Largest data set for --sweep (default 1G)\n"
+	     << "  --sweep-step=X     Growth factor between sweep sizes (default 2)\n"
+	     << "  --search-sweep     Time the search-* patterns (or --patterns) over the same sizes,\n"
+	     << "                       in lookups per second\n"
+	     << "  --prefetch-distance=N  How far ahead shuffled-prefetch prefetches (default 16)\n"
+	     << "  --prefetch-locality=N  Its temporal locality hint, 0-3 (default 3)\n"
+	     << "  --stride=N         How many elements the strided pattern steps over (default 16)\n"
+	     << "  --tile-size=SIZE   Largest tile the shuffled-tiled patterns partition into\n"
+	     << "                       (default: half of L2)\n"
+	     << "  --prefetch-sweep   Time shuffled-prefetch over a range of distances and hints\n"
+	     << "  --prefetch-max=N   Largest distance for --prefetch-sweep (default 512)\n"
+	     << "  --group=N          How many lookups the interleaved patterns overlap (default 8)\n"
+	     << "  --group-sweep      Time the interleaved patterns over a range of --group sizes\n"
+	     << "  --group-max=N      Largest group for --group-sweep (default 64)\n"
+	     << "  --file=PATH        Time the file-* patterns over PATH (created with --data-size\n"
+	     << "                       of random ints if it isn't there), dropping it from the\n"
+	     << "                       page cache before each run (default 5 --iterations)\n"
+	     << "  --file-advice=A    What file-mmap tells madvise(): normal (default),\n"
+	     << "                       sequential, random, or willneed (for each next chunk)\n"
+	     << "  --file-chunk=SIZE  How much of the file to read at a time (default 1M)\n"
+	     << "  --output=FILE      Write the results to FILE, with details of this machine\n"
+	     << "  --format=FORMAT    json, csv, or openmetrics (default: csv if FILE ends in .csv,\n"
+	     << "                       openmetrics if it ends in .prom, otherwise json)\n"
+	     << "  --baseline=FILE    Compare the medians against JSON or CSV --output results,\n"
+	     << "                       exiting with status 2 if any got slower than...\n"
+	     << "  --threshold=PCT    ...this many percent (default 5),\n"
+	     << "                       or 1 if none of them are in the baseline\n"
+	     << "  --quiet            Don't print progress between runs\n"
+	     << "  --histogram        Chart how the run times are distributed, for each pattern\n"
+	     << "  --histogram-chunk=N  Also time every N elements of each run (try 1024),\n"
+	     << "                       and chart those (with --threads=1 only)\n"
+	     << "  --list             List the available patterns and exit\n"
+	     << "  --help             Show this message\n";
+}
+
+// If arg is of the form "<name>=<value>", stores the value and returns true.
+bool matchOption(const string& arg, const char* name, string& value)
+{
+	const size_t len = strlen(name);
+	if (arg.compare(0, len, name) != 0 || arg.size() <= len || arg[len] != '=')
+		return false;
+	value = arg.substr(len + 1);
+	return true;
+}
+
+unsigned long parseNumber(const string& name, const string& value)
+{
+	size_t end;
+	unsigned long n;
+	try {
+		n = stoul(value, &end);
+	}
+	catch (const logic_error&) {
+		end = 0;
+	}
+	if (end == 0 || end != value.size())
+		throw invalid_argument(name + " expects a number, not \"" + value + "\"");
+	return n;
+}
+
+// Parses a size in bytes, with an optional K, M, or G (binary) suffix.
+size_t parseSize(const string& name, const string& value)
+{
+	size_t multiplier = 1;
+	string digits = value;
+	if (!digits.empty()) {
+		switch (toupper(digits.back())) {
+			case 'K': multiplier = 1024; break;
+			case 'M': multiplier = 1024 * 1024; break;
+			case 'G': multiplier = 1024 * 1024 * 1024; break;
+		}
+		if (multiplier != 1)
+			digits.pop_back();
+	}
+	return parseNumber(name, digits) * multiplier;
+}
+
+double parseReal(const string& name, const string& value)
+{
+	size_t end;
+	double d;
+	try {
+		d = stod(value, &end);
+	}
+	catch (const logic_error&) {
+		end = 0;
+	}
+	if (end == 0 || end != value.size())
+		throw invalid_argument(name + " expects a number, not \"" + value + "\"");
+	return d;
+}
+
+// Formats a size in bytes using the biggest binary unit it's a multiple of,
+// e.g., "48K", or "1.5M" if it isn't a whole number of them.
+string formatSize(size_t bytes)
+{
+	static const char* units[] = { "", "K", "M", "G", "T" };
+	double size = (double)bytes;
+	size_t unit = 0;
+	while (size >= 1024 && unit < sizeof(units) / sizeof(units[0]) - 1) {
+		size /= 1024;
+		++unit;
+	}
+	ostringstream ss;
+	ss << setprecision(size == (size_t)size ? 0 : 1) << fixed << size << units[unit];
+	return ss.str();
+}
+
+vector<string> splitList(const string& list)
+{
+	vector<string> ret;
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t comma = list.find(',', start);
+		if (comma == string::npos)
+			comma = list.size();
+		if (comma > start)
+			ret.push_back(list.substr(start, comma - start));
+		start = comma + 1;
+	}
+	return ret;
+}
+
+// Throws invalid_argument on bad input.
+Options parseOptions(int argc, char** argv)
+{
+	Options opts;
+	bool formatSet = false; // Whether --format overrode --output's extension
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		string value;
+		if (matchOption(arg, "--iterations", value)) {
+			opts.iterations = (unsigned int)parseNumber("--iterations", value);
+			opts.iterationsSet = true;
+			if (opts.iterations == 0)
+				throw invalid_argument("--iterations must be at least 1");
+		}
+		else if (matchOption(arg, "--warmup", value)) {
+			opts.warmup = (unsigned int)parseNumber("--warmup", value);
+		}
+		else if (matchOption(arg, "--batch", value)) {
+			opts.batch = (unsigned int)parseNumber("--batch", value);
+		}
+		else if (matchOption(arg, "--regenerate", value)) {
+			opts.regenerate = (unsigned int)parseNumber("--regenerate", value);
+			if (opts.regenerate == 0)
+				throw invalid_argument("--regenerate must be at least 1");
+		}
+		else if (arg == "--reject-outliers") {
+			opts.rejectOutliers = true;
+		}
+		else if (matchOption(arg, "--seed", value)) {
+			opts.seed = parseNumber("--seed", value);
+			opts.seedSet = true;
+		}
+		else if (matchOption(arg, "--perm-cache", value)) {
+			opts.permCache = value;
+		}
+		else if (matchOption(arg, "--patterns", value)) {
+			opts.patterns = splitList(value);
+		}
+		else if (matchOption(arg, "--flush", value)) {
+			opts.flush = parseFlushMode(value);
+		}
+		else if (matchOption(arg, "--cache-size", value)) {
+			opts.cacheSize = parseSize("--cache-size", value);
+		}
+		else if (matchOption(arg, "--data-size", value)) {
+			opts.dataSize = parseSize("--data-size", value);
+		}
+		else if (matchOption(arg, "--threads", value)) {
+			opts.threads = parseNumber("--threads", value);
+			if (opts.threads == 0)
+				throw invalid_argument("--threads must be at least 1");
+		}
+		else if (arg == "--scaling") {
+			opts.scaling = true;
+		}
+		else if (matchOption(arg, "--data-node", value)) {
+			opts.dataPlacement.kind = NumaPlacement::Bind;
+			opts.dataPlacement.node = (int)parseNumber("--data-node", value);
+		}
+		else if (matchOption(arg, "--pointer-node", value)) {
+			opts.auxPlacement.kind = NumaPlacement::Bind;
+			opts.auxPlacement.node = (int)parseNumber("--pointer-node", value);
+			opts.auxPlacementSet = true;
+		}
+		else if (arg == "--interleave") {
+			opts.dataPlacement.kind = NumaPlacement::Interleave;
+		}
+		else if (matchOption(arg, "--cpu-node", value)) {
+			opts.cpuNode = (int)parseNumber("--cpu-node", value);
+		}
+		else if (arg == "--numa-matrix") {
+			opts.numaMatrix = true;
+		}
+		else if (arg == "--perf") {
+			opts.perf = true;
+		}
+		else if (matchOption(arg, "--pin-cpu", value)) {
+			opts.pinCpu = (int)parseNumber("--pin-cpu", value);
+		}
+		else if (arg == "--raise-priority") {
+			opts.raisePriority = true;
+		}
+		else if (arg == "--frequency") {
+			opts.frequency = true;
+		}
+		else if (matchOption(arg, "--smt-noise", value)) {
+			if (value == "alu")
+				opts.smtNoise = NoiseKind::Alu;
+			else if (value == "memory")
+				opts.smtNoise = NoiseKind::Memory;
+			else
+				throw invalid_argument("--smt-noise must be alu or memory");
+		}
+		else if (matchOption(arg, "--pages", value)) {
+			opts.pages = parsePageMode(value);
+		}
+		else if (arg == "--page-compare") {
+			opts.pageCompare = true;
+		}
+		else if (arg == "--sweep") {
+			opts.sweep = true;
+		}
+		else if (matchOption(arg, "--sweep-min", value)) {
+			opts.sweepMin = parseSize("--sweep-min", value);
+		}
+		else if (matchOption(arg, "--sweep-max", value)) {
+			opts.sweepMax = parseSize("--sweep-max", value);
+		}
+		else if (matchOption(arg, "--sweep-step", value)) {
+			opts.sweepStep = parseReal("--sweep-step", value);
+			if (!(opts.sweepStep > 1))
+				throw invalid_argument("--sweep-step must be greater than 1");
+		}
+		else if (matchOption(arg, "--prefetch-distance", value)) {
+			opts.params.prefetchDistance = parseNumber("--prefetch-distance", value);
+		}
+		else if (matchOption(arg, "--prefetch-locality", value)) {
+			const unsigned long locality = parseNumber("--prefetch-locality", value);
+			if (locality > 3)
+				throw invalid_argument("--prefetch-locality must be between 0 and 3");
+			opts.params.prefetchLocality = (int)locality;
+		}
+		else if (matchOption(arg, "--tile-size", value)) {
+			opts.params.tileSize = parseSize("--tile-size", value);
+			opts.tileSizeSet = true;
+		}
+		else if (matchOption(arg, "--stride", value)) {
+			opts.params.stride = parseNumber("--stride", value);
+			if (opts.params.stride == 0)
+				throw invalid_argument("--stride must be at least 1");
+		}
+		else if (arg == "--prefetch-sweep") {
+			opts.prefetchSweep = true;
+		}
+		else if (matchOption(arg, "--prefetch-max", value)) {
+			opts.prefetchMax = parseNumber("--prefetch-max", value);
+		}
+		else if (matchOption(arg, "--group", value)) {
+			opts.params.group = parseNumber("--group", value);
+			if (opts.params.group == 0 || opts.params.group > detail::maxGroup)
+				throw invalid_argument("--group must be between 1 and " + to_string(detail::maxGroup));
+		}
+		else if (arg == "--search-sweep") {
+			opts.searchSweep = true;
+		}
+		else if (arg == "--group-sweep") {
+			opts.groupSweep = true;
+		}
+		else if (matchOption(arg, "--group-max", value)) {
+			opts.groupMax = min<size_t>(parseNumber("--group-max", value), detail::maxGroup);
+			if (opts.groupMax == 0)
+				throw invalid_argument("--group-max must be at least 1");
+		}
+		else if (matchOption(arg, "--file", value)) {
+			opts.file = value;
+		}
+		else if (matchOption(arg, "--file-advice", value)) {
+			if (value == "normal")
+				opts.fileAdvice = FileAdvice::Normal;
+			else if (value == "sequential")
+				opts.fileAdvice = FileAdvice::Sequential;
+			else if (value == "random")
+				opts.fileAdvice = FileAdvice::Random;
+			else if (value == "willneed")
+				opts.fileAdvice = FileAdvice::WillNeed;
+			else
+				throw invalid_argument("Unknown --file-advice \"" + value + "\"");
+		}
+		else if (matchOption(arg, "--file-chunk", value)) {
+			opts.fileChunk = parseSize("--file-chunk", value);
+			if (opts.fileChunk == 0)
+				throw invalid_argument("--file-chunk must be at least 1");
+		}
+		else if (matchOption(arg, "--output", value)) {
+			opts.output = value;
+			if (!formatSet) {
+				auto endsWith = [&](const char* suffix) {
+					const size_t len = strlen(suffix);
+					return value.size() >= len && value.compare(value.size() - len, len, suffix) == 0;
+				};
+				opts.format = endsWith(".csv") ? "csv" : endsWith(".prom") ? "openmetrics" : "json";
+			}
+		}
+		else if (matchOption(arg, "--format", value)) {
+			if (value != "json" && value != "csv" && value != "openmetrics")
+				throw invalid_argument("--format must be json, csv, or openmetrics");
+			opts.format = value;
+			formatSet = true;
+		}
+		else if (matchOption(arg, "--baseline", value)) {
+			opts.baseline = value;
+		}
+		else if (matchOption(arg, "--threshold", value)) {
+			opts.threshold = parseReal("--threshold", value) / 100;
+			if (!(opts.threshold >= 0))
+				throw invalid_argument("--threshold can't be negative");
+		}
+		else if (arg == "--quiet") {
+			opts.quiet = true;
+		}
+		else if (arg == "--histogram") {
+			opts.histogram = true;
+		}
+		else if (matchOption(arg, "--histogram-chunk", value)) {
+			opts.histogramChunk = parseNumber("--histogram-chunk", value);
+			if (opts.histogramChunk == 0)
+				throw invalid_argument("--histogram-chunk must be at least 1");
+			opts.histogram = true;
+		}
+		else if (arg == "--list") {
+			opts.list = true;
+		}
+		else if (arg == "--help") {
+			opts.help = true;
+		}
+		else {
+			throw invalid_argument("Unknown option \"" + arg + "\"");
+		}
+	}
+	if (!opts.auxPlacementSet)
+		opts.auxPlacement = opts.dataPlacement;
+	if (opts.numaMatrix && (opts.pinCpu >= 0 || opts.smtNoise != NoiseKind::None))
+		throw invalid_argument("--numa-matrix picks its own CPUs, so it can't take --pin-cpu or --smt-noise");
+	if ((!opts.output.empty() || !opts.baseline.empty()) &&
+	    (opts.scaling || opts.numaMatrix || opts.pageCompare || opts.prefetchSweep || opts.groupSweep))
+		throw invalid_argument("Only regular runs, --sweep, --search-sweep, and --file have results"
+		                       " for --output or --baseline");
+	if (opts.histogramChunk > 0 && opts.threads > 1)
+		throw invalid_argument("--histogram-chunk times one thread's work, so it needs --threads=1");
+	if (opts.sweepMin == 0 || opts.sweepMin > opts.sweepMax)
+		throw invalid_argument("--sweep-min must be between 1 and --sweep-max");
+	return opts;
+}
+
+// A pattern we're timing, along with its running results
+struct PatternRun {
+	const PatternInfo* info;
+	unique_ptr<AccessPattern> pattern;
+
+	// How long each run took, in nanoseconds per call,
+	// excluding the setup and measurement work we do around them.
+	// This is sized up front so that we never allocate in the timing loop.
+	vector<double> samples;
+
+	// How many calls each run times together (see chooseBatch())
+	unsigned int batch = 0;
+
+	// With --perf, the total of each hardware counter over every (non-warmup) run,
+	// and which of perfEvents() each one is
+	vector<double> counts = {};
+	vector<size_t> countedEvents = {};
+
+	// The same run times, as a histogram, and with --histogram-chunk,
+	// how long each chunk of each run took (in timer ticks)
+	LatencyHistogram callTimes = LatencyHistogram();
+	LatencyHistogram chunkTimes = LatencyHistogram();
+
+	// With --frequency, the timing thread's cycles over every (non-warmup) run,
+	// and where they came from
+	ClockCounts clock = ClockCounts();
+	const char* clockSource = nullptr;
+
+	// Set if the pattern couldn't take the current data set (see setupPatterns()),
+	// in which case it isn't timed or reported
+	bool skipped = false;
+};
+
+// Sets each pattern up with the given data set,
+// then moves the data and the patterns' own memory to the NUMA nodes we were asked to.
+void setupPatterns(vector<PatternRun>& runs, DataSet& data,
+                   const NumaPlacement& dataPlacement, const NumaPlacement& auxPlacement)
+{
+	// A pattern that can't handle a data set this big shouldn't stop the others,
+	// so skip it (saying so the first time).
+	static set<string> tooBig;
+	for (auto& r : runs) {
+		r.skipped = false;
+		try {
+			r.pattern->setup(data);
+		}
+		catch (const length_error& e) {
+			r.skipped = true;
+			if (tooBig.insert(r.info->name).second)
+				cerr << "Warning: skipping " << r.info->name << " over data sets this big (" << e.what() << ")\n";
+		}
+	}
+
+	vector<MemoryRegion> regions;
+	string error = placeMemory({data.data(), data.size() * sizeof(int)}, dataPlacement);
+	for (auto& r : runs) {
+		if (r.skipped)
+			continue;
+		regions.clear();
+		r.pattern->auxiliaryMemory(regions);
+		mergeByPage(regions);
+		for (const auto& region : regions) {
+			if (error.empty())
+				error = placeMemory(region, auxPlacement);
+		}
+	}
+
+	// Keep going, but say so, since the results won't mean what they were supposed to.
+	static bool warned = false;
+	if (!error.empty() && !warned) {
+		cerr << "Warning: couldn't place memory on the requested NUMA nodes (" << error << ")\n";
+		warned = true;
+	}
+
+	// Ditto if we didn't get the pages we asked for.
+	for (const auto& w : pageWarnings())
+		cerr << "Warning: " << w << "\n";
+	pageWarnings().clear();
+}
+
+void setupPatterns(vector<PatternRun>& runs, DataSet& data, const Options& opts)
+{
+	setupPatterns(runs, data, opts.dataPlacement, opts.auxPlacement);
+}
+
+// Returns the CPUs we should run on: those of the requested node, if there is one,
+// or every CPU we're allowed to use.
+// With --pin-cpu, that one comes first (for the timed thread),
+// and with --smt-noise, its SMT siblings are left to the noise.
+vector<int> cpusToUse(const Options& opts)
+{
+	vector<int> cpus;
+	if (opts.cpuNode >= 0) {
+		for (const auto& n : numaNodes()) {
+			if (n.id == opts.cpuNode)
+				cpus = n.cpus;
+		}
+		if (cpus.empty())
+			throw invalid_argument("There is no NUMA node " + to_string(opts.cpuNode));
+	}
+	else {
+		cpus = availableCPUs();
+	}
+
+	if (opts.pinCpu >= 0) {
+		auto found = find(cpus.begin(), cpus.end(), opts.pinCpu);
+		if (found == cpus.end())
+			throw invalid_argument("We can't run on CPU " + to_string(opts.pinCpu));
+		rotate(cpus.begin(), found, found + 1);
+	}
+	if (opts.smtNoise != NoiseKind::None) {
+		for (int sibling : smtSiblings(cpus.front()))
+			cpus.erase(remove(cpus.begin() + 1, cpus.end(), sibling), cpus.end());
+	}
+	return cpus;
+}
+
+// Picks how many calls to the pattern we need to time together
+// (see chooseBatch() in benchmark.hpp), flushing before each trial like a real run.
+unsigned int chooseBatch(AccessPattern& pattern, const vector<MemoryRegion>& regions,
+                         CacheFlusher& flusher, ThreadTeam& team)
+{
+	return chooseBatch(
+		[&] {
+			flusher.flush(regions);
+			pattern.evict();
+		},
+		[&] { return team.run(pattern); });
+}
+
+// Does the pattern's work (on this thread) a chunk at a time,
+// recording how long each chunk took.
+// Reading the timer between chunks costs a few dozen cycles each time,
+// which for chunks of a thousand or so elements is lost in the work itself.
+int runInChunks(const AccessPattern& pattern, size_t chunk, LatencyHistogram& times)
+{
+	const Timer& t = timer();
+	const size_t n = pattern.size();
+	uint64_t sum = 0;
+	uint64_t last = t.start();
+	for (size_t first = 0; first < n; first += chunk) {
+		sum += pattern.sumRange(first, min(n, first + chunk));
+		const uint64_t now = t.stop();
+		times.record(now - last);
+		last = now;
+	}
+	return (int)(sum / n);
+}
+
+// Repopulates the data set and times each pattern over it,
+// warmup + iterations times, filling in each pattern's samples.
+// Patterns should already be set up with this data set.
+void timePatterns(vector<PatternRun>& runs, DataSet& data, const Options& opts,
+                  CacheFlusher& flusher, ThreadTeam& team, default_random_engine& re,
+                  bool showProgress)
+{
+	const unsigned int iterations = opts.iterations;
+	const unsigned int warmup = opts.warmup;
+
+	for (auto& r : runs) {
+		r.samples.resize(iterations);
+		r.batch = 0;
+		r.counts.clear();
+		r.countedEvents.clear();
+		r.callTimes.clear();
+		r.chunkTimes = LatencyHistogram(timer().tickLength());
+		r.clock = ClockCounts();
+		r.clockSource = nullptr;
+	}
+	const bool chunked = opts.histogramChunk > 0 && team.size() == 1;
+
+	// Hardware counters, if we were asked for them and the kernel lets us have them.
+	// If not, keep going without them.
+	unique_ptr<PerfCounters> perf;
+	if (opts.perf) {
+		perf.reset(new PerfCounters);
+		static bool warned = false;
+		if (!perf->error().empty() && !warned) {
+			cerr << "Warning: " << perf->error()
+			     << (perf->available() ? "" : ", so running without performance counters") << "\n";
+			warned = true;
+		}
+		if (!perf->available())
+			perf.reset();
+	}
+
+	// Ditto for the clock frequency
+	unique_ptr<FrequencyMeter> clock;
+	if (opts.frequency) {
+		clock.reset(new FrequencyMeter);
+		static bool warned = false;
+		if (!clock->available() && !warned) {
+			cerr << "Warning: " << clock->error() << ", so running without --frequency\n";
+			warned = true;
+		}
+		if (!clock->available())
+			clock.reset();
+	}
+
+	// What we need to flush before each pattern runs.
+	// This is refilled for each pattern, but allocated only once.
+	vector<MemoryRegion> regions;
+
+	const Timer& t = timer();
+
+	for (unsigned int i = 0; i < warmup + iterations; ++i) {
+		const bool warmingUp = i < warmup;
+
+		// Every pattern sees the same data on a given iteration.
+		// If we're regenerating less often, the patterns keep their
+		// shuffles (and copies of the data) from last time, too.
+		const bool regenerating = i % opts.regenerate == 0;
+		if (regenerating)
+			populateDataSet(data, drawKey(re));
+
+		for (auto& r : runs) {
+			if (r.skipped)
+				continue;
+			if (regenerating)
+				r.pattern->prepare(re);
+
+			regions.clear();
+			regions.push_back({data.data(), data.size() * sizeof(int)});
+			if (flusher.getMode() == FlushMode::Stream)
+				r.pattern->ownedMemory(regions);
+			else
+				r.pattern->auxiliaryMemory(regions);
+			if (r.batch == 0)
+				r.batch = opts.batch > 0 ? opts.batch : chooseBatch(*r.pattern, regions, flusher, team);
+			flusher.flush(regions);
+			r.pattern->evict();
+
+			// ...and go!
+			// (Each call's result is kept with doNotOptimize(), so the compiler
+			// can't eliminate the work as a dead store.)
+			// (The clock's readings are outside the timed region, too.)
+			uint64_t actualBefore = 0, referenceBefore = 0;
+			if (clock && !warmingUp)
+				clock->read(actualBefore, referenceBefore);
+			const uint64_t clockStart = t.start();
+
+			int result = 0;
+			double ns;
+			if (chunked && !warmingUp) {
+				ns = timeBatch(
+					r.batch, [&] { return result = runInChunks(*r.pattern, opts.histogramChunk, r.chunkTimes); },
+					perf.get());
+			}
+			else {
+				ns = timeBatch(
+					r.batch, [&] { return result = team.run(*r.pattern); }, warmingUp ? nullptr : perf.get());
+			}
+			if (clock && !warmingUp) {
+				const uint64_t clockEnd = t.stop();
+				uint64_t actualAfter, referenceAfter;
+				clock->read(actualAfter, referenceAfter);
+				FrequencyMeter::add(r.clock, actualBefore, referenceBefore, actualAfter, referenceAfter,
+				                    t.nanoseconds(clockEnd - clockStart));
+				r.clockSource = clock->source();
+			}
+			if (!warmingUp) {
+				r.samples[i - warmup] = ns;
+				r.callTimes.recordNs(ns);
+				if (perf) {
+					perf->addTo(r.counts);
+					r.countedEvents = perf->events();
+				}
+			}
+
+			// Show the result, to give us something to look at.
+			if (showProgress) {
+				if (warmingUp)
+					cout << "Warmup " << i + 1;
+				else
+					cout << "Run " << i - warmup + 1;
+				cout << " (" << r.info->name << "): " << result << "\r";
+				cout.flush();
+			}
+		}
+	}
+	if (showProgress)
+		cout << "\n";
+
+	for (const auto& w : permutationWarnings())
+		cerr << "Warning: " << w << "\n";
+	permutationWarnings().clear();
+}
+
+// Prints the average of each hardware counter per element,
+// along with instructions per cycle if we counted both.
+void printCounts(const PatternRun& r, const Options& opts)
+{
+	const double elements = (double)r.pattern->size() * opts.iterations * r.batch;
+	double cycles = 0;
+	double instructions = 0;
+
+	cout << "  per element:" << setprecision(3);
+	for (size_t i = 0; i < r.counts.size(); ++i) {
+		const char* name = perfEvents()[r.countedEvents[i]].name;
+		cout << (i == 0 ? " " : ", ") << r.counts[i] / elements << " " << name;
+		if (strcmp(name, "cycles") == 0)
+			cycles = r.counts[i];
+		else if (strcmp(name, "instructions") == 0)
+			instructions = r.counts[i];
+	}
+	if (cycles > 0 && instructions > 0)
+		cout << " (" << setprecision(2) << instructions / cycles << " IPC)";
+	cout << "\n";
+}
+
+// Bundles up a pattern's results for --output and --baseline
+ResultRow resultRow(const PatternRun& r, const Summary& s, const DataSet& data,
+                    const Options& opts, size_t threads)
+{
+	ResultRow row;
+	row.pattern = r.info->name;
+	row.dataBytes = data.size() * sizeof(int);
+	row.elements = r.pattern->size();
+	row.threads = threads;
+	row.batch = r.batch;
+	row.bytesPerElement = r.pattern->bytesPerElement();
+	row.summary = s;
+	row.callTimes = r.callTimes;
+	row.chunkTimes = r.chunkTimes;
+	if (!r.chunkTimes.empty())
+		row.chunkElements = opts.histogramChunk;
+	const double elements = (double)row.elements * opts.iterations * r.batch;
+	for (size_t i = 0; i < r.counts.size(); ++i)
+		row.counts.emplace_back(perfEvents()[r.countedEvents[i]].name, r.counts[i] / elements);
+	return row;
+}
+
+// Times every pattern over one data set (of the default size)
+// and prints detailed statistics for each.
+void runOnce(vector<PatternRun>& runs, const Options& opts, CacheFlusher& flusher,
+             ThreadTeam& team, default_random_engine& re, vector<ResultRow>& results)
+{
+	// Our test data set
+	auto data = DataSet(max<size_t>(1, opts.dataSize / sizeof(int)));
+
+	setupPatterns(runs, data, opts);
+
+	timePatterns(runs, data, opts, flusher, team, re, !opts.quiet);
+
+	// The first pattern's median, which we compare the others against
+	const PatternRun* first = nullptr;
+	double baseline = 0;
+
+	for (auto& r : runs) {
+		if (r.skipped)
+			continue;
+		const Summary s = summarize(r.samples, opts.rejectOutliers);
+		results.push_back(resultRow(r, s, data, opts, team.size()));
+		if (first == nullptr) {
+			first = &r;
+			baseline = s.median;
+		}
+
+		cout << "\n" << r.info->name << ": " << opts.iterations << " runs";
+		if (opts.warmup > 0)
+			cout << " after " << opts.warmup << " warmup runs";
+		if (r.batch > 1)
+			cout << " of " << r.batch << " calls each";
+		cout << ", " << s.outliers << (s.outliers == 1 ? " outlier" : " outliers")
+		     << (s.outliersRejected ? " rejected" : "") << "\n";
+		cout << "  min " << formatTime(s.min)
+		     << ", median " << formatTime(s.median)
+		     << ", p90 " << formatTime(s.p90)
+		     << ", p99 " << formatTime(s.p99)
+		     << ", max " << formatTime(s.max) << "\n";
+		cout << "  mean " << formatTime(s.mean) << " ± " << formatTime(s.ci95)
+		     << " (95% CI), stddev " << formatTime(s.stddev) << "\n";
+		if (!r.counts.empty())
+			printCounts(r, opts);
+		if (&r != first) {
+			cout << "  median is " << setprecision(2) << s.median / baseline << "x "
+			     << first->info->name << "'s\n";
+		}
+		if (!r.clock.empty()) {
+			cout << "  clock " << setprecision(2) << r.clock.ghz() << " GHz";
+			if (r.clock.reference > 0)
+				cout << " (" << r.clock.actual / r.clock.reference << "x the nominal "
+				     << r.clock.nominalGHz() << " GHz)";
+			cout << ", from " << r.clockSource << "\n";
+		}
+		if (opts.histogram) {
+			cout << "  Time per call:\n";
+			printHistogram(cout, r.callTimes);
+		}
+		if (!r.chunkTimes.empty()) {
+			const LatencyHistogram& h = r.chunkTimes;
+			cout << "  Time per " << opts.histogramChunk << " elements (median "
+			     << formatTime(h.percentileNs(0.5)) << ", p99 " << formatTime(h.percentileNs(0.99))
+			     << ", p99.9 " << formatTime(h.percentileNs(0.999)) << ", max " << formatTime(h.maxNs())
+			     << "):\n";
+			printHistogram(cout, h);
+		}
+	}
+}
+
+// Times every pattern over data sets that grow geometrically
+// from opts.sweepMin to opts.sweepMax bytes, printing a table of
+// the (median) time per element and bandwidth at each size.
+// Plot this and you should see a cliff each time the data set
+// outgrows a level of cache.
+void runSweep(vector<PatternRun>& runs, const Options& opts, CacheFlusher& flusher,
+              ThreadTeam& team, default_random_engine& re, vector<ResultRow>& results)
+{
+	// Header
+	cout << setw(12) << "data set";
+	for (const auto& r : runs)
+		cout << " | " << setw(21) << r.info->name;
+	cout << "\n" << setw(12) << "";
+	for (size_t i = 0; i < runs.size(); ++i)
+		cout << " | " << setw(10) << "ns/elem" << setw(11) << "GB/s";
+	cout << "\n";
+
+	for (size_t bytes = opts.sweepMin; bytes <= opts.sweepMax;
+	     bytes = max(bytes + sizeof(int), (size_t)(bytes * opts.sweepStep))) {
+		auto data = DataSet(max<size_t>(1, bytes / sizeof(int)));
+
+		setupPatterns(runs, data, opts);
+
+		timePatterns(runs, data, opts, flusher, team, re, false);
+
+		cout << setw(12) << formatSize(data.size() * sizeof(int));
+		for (auto& r : runs) {
+			if (r.skipped) {
+				cout << " | " << setw(10) << "-" << setw(11) << "-";
+				continue;
+			}
+			const Summary s = summarize(r.samples, opts.rejectOutliers);
+			results.push_back(resultRow(r, s, data, opts, team.size()));
+			const double elements = (double)r.pattern->size();
+			const double bytesTouched = r.pattern->bytesPerElement() * elements;
+			// Bytes per nanosecond is (decimal) gigabytes per second.
+			cout << " | " << setw(10) << setprecision(3) << s.median / elements
+			     << setw(11) << setprecision(2) << bytesTouched / s.median;
+		}
+		cout << endl;
+	}
+}
+
+// runSweep() for the search patterns (see search.hpp), printing how many
+// millions of lookups per second each one manages at each data set size.
+void runSearchSweep(vector<PatternRun>& runs, const Options& opts, CacheFlusher& flusher,
+                    ThreadTeam& team, default_random_engine& re, vector<ResultRow>& results)
+{
+	cout << "Millions of lookups per second:\n";
+	cout << setw(12) << "data set";
+	for (const auto& r : runs)
+		cout << " | " << setw(25) << r.info->name;
+	cout << "\n";
+
+	for (size_t bytes = opts.sweepMin; bytes <= opts.sweepMax;
+	     bytes = max(bytes + sizeof(int), (size_t)(bytes * opts.sweepStep))) {
+		auto data = DataSet(max<size_t>(1, bytes / sizeof(int)));
+
+		setupPatterns(runs, data, opts);
+
+		timePatterns(runs, data, opts, flusher, team, re, false);
+
+		cout << setw(12) << formatSize(data.size() * sizeof(int));
+		for (auto& r : runs) {
+			if (r.skipped) {
+				cout << " | " << setw(25) << "-";
+				continue;
+			}
+			const Summary s = summarize(r.samples, opts.rejectOutliers);
+			results.push_back(resultRow(r, s, data, opts, team.size()));
+			// Lookups per nanosecond is thousands of millions per second.
+			cout << " | " << setw(25) << setprecision(2) << r.pattern->size() / s.median * 1e3;
+		}
+		cout << endl;
+	}
+}
+
+void printTopology(const CacheTopology& topology)
+{
+	cout << "Caches (from " << topology.source << "):";
+	for (const auto& c : topology.levels) {
+		if (!c.holdsData())
+			continue;
+		cout << " L" << c.level << (c.type == "Data" ? "d " : " ") << formatSize(c.size);
+		if (c.sharedBy > 1)
+			cout << " (shared by " << c.sharedBy << " CPUs)";
+	}
+	cout << ", " << topology.lineSize() << " byte lines\n";
+}
+
+// Times the shuffled-prefetch pattern with each locality hint
+// and a range of prefetch distances (0, then powers of two up to opts.prefetchMax)
+// and prints the time per element of each, along with the best combination.
+// Distance zero means no prefetching, which is what we compare against.
+void runPrefetchSweep(const Options& opts, CacheFlusher& flusher,
+                      ThreadTeam& team, default_random_engine& re)
+{
+	const PatternInfo* info = findPattern("shuffled-prefetch");
+	auto data = DataSet(max<size_t>(1, opts.dataSize / sizeof(int)));
+
+	vector<size_t> distances = { 0 };
+	for (size_t d = 1; d <= opts.prefetchMax; d *= 2)
+		distances.push_back(d);
+
+	cout << "Nanoseconds per element with a " << formatSize(data.size() * sizeof(int))
+	     << " data set:\n";
+	cout << setw(10) << "distance";
+	for (int l = 0; l <= 3; ++l)
+		cout << " | " << setw(8) << "hint " << l;
+	cout << "\n";
+
+	double noPrefetch = 0;
+	double best = 0;
+	size_t bestDistance = 0;
+	int bestLocality = 0;
+
+	for (size_t d : distances) {
+		cout << setw(10) << d;
+		for (int l = 0; l <= 3; ++l) {
+			PatternParams params = opts.params;
+			params.prefetchDistance = d;
+			params.prefetchLocality = l;
+
+			// One at a time, since each has its own (big) pointer array
+			vector<PatternRun> runs;
+			runs.push_back({info, info->create(params), {}});
+			setupPatterns(runs, data, opts);
+			timePatterns(runs, data, opts, flusher, team, re, false);
+
+			const double perElement =
+				summarize(runs.front().samples, opts.rejectOutliers).median / data.size();
+			if (d == 0 && l == 0)
+				noPrefetch = perElement;
+			if (best == 0 || perElement < best) {
+				best = perElement;
+				bestDistance = d;
+				bestLocality = l;
+			}
+			cout << " | " << setw(9) << setprecision(3) << perElement;
+			cout.flush();
+		}
+		cout << "\n";
+	}
+
+	cout << "\nBest: distance " << bestDistance << " with hint " << bestLocality
+	     << " (" << setprecision(3) << best << " ns/element, "
+	     << setprecision(2) << noPrefetch / best << "x as fast as no prefetching)\n";
+}
+
+// Times the interleaved patterns (see interleave.hpp) with groups of
+// 1, 2, 4, ... lookups, up to opts.groupMax, against the plain versions of their walks,
+// and prints the time per element of each and how much faster the best group is.
+void runGroupSweep(const Options& opts, CacheFlusher& flusher,
+                   ThreadTeam& team, default_random_engine& re)
+{
+	const char* const names[][2] = {
+		{ "shuffled-chase", "shuffled-chase-interleaved" },
+		{ "shuffled-indirect", "shuffled-group" },
+	};
+	auto data = DataSet(max<size_t>(1, opts.dataSize / sizeof(int)));
+
+	// One at a time, since each has its own (big) arrays
+	auto time = [&](const char* name, const PatternParams& params) {
+		vector<PatternRun> runs;
+		const PatternInfo* info = findPattern(name);
+		runs.push_back({info, info->create(params), {}});
+		setupPatterns(runs, data, opts);
+		if (runs.front().skipped)
+			throw runtime_error(string("--group-sweep needs ") + name + ", which can't take this data set");
+		timePatterns(runs, data, opts, flusher, team, re, false);
+		return summarize(runs.front().samples, opts.rejectOutliers).median / runs.front().pattern->size();
+	};
+
+	cout << "Nanoseconds per element with a " << formatSize(data.size() * sizeof(int))
+	     << " data set:\n";
+	cout << setw(10) << "group";
+	for (const auto& n : names)
+		cout << " | " << setw(26) << n[1];
+	cout << "\n";
+
+	double plain[2];
+	double best[2] = { 0, 0 };
+	size_t bestGroup[2] = { 0, 0 };
+
+	cout << setw(10) << "plain";
+	for (int k = 0; k < 2; ++k) {
+		plain[k] = time(names[k][0], opts.params);
+		cout << " | " << setw(26) << setprecision(3) << plain[k];
+		cout.flush();
+	}
+	cout << "\n";
+
+	for (size_t g = 1; g <= opts.groupMax; g *= 2) {
+		cout << setw(10) << g;
+		for (int k = 0; k < 2; ++k) {
+			PatternParams params = opts.params;
+			params.group = g;
+			const double perElement = time(names[k][1], params);
+			if (best[k] == 0 || perElement < best[k]) {
+				best[k] = perElement;
+				bestGroup[k] = g;
+			}
+			cout << " | " << setw(26) << setprecision(3) << perElement;
+			cout.flush();
+		}
+		cout << "\n";
+	}
+
+	cout << "\n";
+	for (int k = 0; k < 2; ++k) {
+		cout << "Best " << names[k][1] << ": group " << bestGroup[k]
+		     << " (" << setprecision(3) << best[k] << " ns/element, "
+		     << setprecision(2) << plain[k] / best[k] << "x as fast as " << names[k][0] << ")\n";
+	}
+}
+
+// Times the patterns over --file (and, if there are any that don't read it,
+// over a data set of the usual size), dropping the file from the page cache
+// before every run, and prints how close each gets to the device's own bandwidth.
+void runFile(vector<PatternRun>& runs, const Options& opts, CacheFlusher& flusher,
+             ThreadTeam& team, default_random_engine& re, vector<ResultRow>& results)
+{
+	bool inMemory = false;
+	for (const auto& r : runs)
+		inMemory = inMemory || r.info->supported != haveDataFile;
+	auto data = DataSet(inMemory ? max<size_t>(1, opts.dataSize / sizeof(int)) : 1);
+
+	setupPatterns(runs, data, opts);
+
+	cout << "Reading " << opts.file << " a " << formatSize(opts.fileChunk)
+	     << " chunk at a time (file-stream uses " << streamingMethod() << ")\n";
+	const double device = deviceReadBandwidth();
+	cout << "On its own, the device reads it at " << setprecision(2) << device << " GB/s\n";
+
+	timePatterns(runs, data, opts, flusher, team, re, !opts.quiet);
+
+	cout << "\n" << setw(24) << "pattern" << setw(12) << "median" << setw(10) << "GB/s"
+	     << setw(12) << "of device\n";
+	for (auto& r : runs) {
+		if (r.skipped)
+			continue;
+		const Summary s = summarize(r.samples, opts.rejectOutliers);
+		ResultRow row = resultRow(r, s, data, opts, team.size());
+		if (r.info->supported == haveDataFile)
+			row.dataBytes = r.pattern->size() * sizeof(int);
+		const double gbPerSecond = row.gbPerSecond();
+		cout << setw(24) << r.info->name << setw(12) << formatTime(s.median)
+		     << setw(10) << setprecision(2) << gbPerSecond;
+		if (r.info->supported == haveDataFile)
+			cout << setw(11) << setprecision(0) << 100 * gbPerSecond / device << "%";
+		cout << "\n";
+		results.push_back(row);
+	}
+}
+
+// Times every pattern over one data set with 1, 2, 4, ... threads,
+// up to one per available CPU, and prints how throughput scales with each.
+// Efficiency is the speedup over one thread divided by the number of threads,
+// so 100% is perfect scaling, and it drops off as we run out of memory bandwidth.
+void runScaling(vector<PatternRun>& runs, const Options& opts,
+                CacheFlusher& flusher, default_random_engine& re)
+{
+	const vector<int> cpus = cpusToUse(opts);
+
+	vector<size_t> counts;
+	for (size_t n = 1; n < cpus.size(); n *= 2)
+		counts.push_back(n);
+	counts.push_back(cpus.size());
+
+	auto data = DataSet(max<size_t>(1, opts.dataSize / sizeof(int)));
+	setupPatterns(runs, data, opts);
+
+	// medians[i][j] is the median time of pattern j with counts[i] threads
+	vector<vector<double>> medians;
+	for (size_t n : counts) {
+		cout << "Timing with " << n << (n == 1 ? " thread" : " threads") << "...\r";
+		cout.flush();
+
+		ThreadTeam team(n, cpus);
+		timePatterns(runs, data, opts, flusher, team, re, false);
+
+		medians.emplace_back();
+		for (auto& r : runs)
+			medians.back().push_back(r.skipped ? 0 : summarize(r.samples, opts.rejectOutliers).median);
+	}
+
+	for (size_t j = 0; j < runs.size(); ++j) {
+		if (runs[j].skipped)
+			continue;
+		const double elements = (double)runs[j].pattern->size();
+		const double bytes = runs[j].pattern->bytesPerElement() * elements;
+
+		cout << "\n" << runs[j].info->name << " over " << formatSize(data.size() * sizeof(int)) << ":\n";
+		cout << setw(8) << "threads" << setw(14) << "median" << setw(10) << "GB/s"
+		     << setw(10) << "speedup" << setw(12) << "efficiency" << "\n";
+		for (size_t i = 0; i < counts.size(); ++i) {
+			const double speedup = medians[0][j] / medians[i][j];
+			cout << setw(8) << counts[i]
+			     << setw(14) << formatTime(medians[i][j])
+			     << setw(10) << setprecision(2) << bytes / medians[i][j]
+			     << setw(9) << setprecision(2) << speedup << "x"
+			     << setw(11) << setprecision(1) << speedup / counts[i] * 100 << "%\n";
+		}
+	}
+}
+
+// Times every pattern running on each NUMA node's CPUs,
+// with its memory on each NUMA node, and prints a matrix of the results.
+// The diagonal is local memory; everything else is remote.
+void runNumaMatrix(vector<PatternRun>& runs, const Options& opts,
+                   CacheFlusher& flusher, default_random_engine& re)
+{
+	const vector<NumaNode> nodes = numaNodes();
+
+	auto data = DataSet(max<size_t>(1, opts.dataSize / sizeof(int)));
+
+	// results[c][m][j] is the median time of pattern j running on node c,
+	// with memory on node m.
+	vector<vector<vector<double>>> results(nodes.size());
+	for (size_t c = 0; c < nodes.size(); ++c) {
+		if (nodes[c].cpus.empty())
+			continue; // A memory-only node
+
+		// Use as many of the node's CPUs as we have threads
+		ThreadTeam team(opts.threads, nodes[c].cpus);
+
+		for (size_t m = 0; m < nodes.size(); ++m) {
+			cout << "Timing CPU node " << nodes[c].id << " to memory node " << nodes[m].id << "...\r";
+			cout.flush();
+
+			NumaPlacement placement;
+			placement.kind = NumaPlacement::Bind;
+			placement.node = nodes[m].id;
+			setupPatterns(runs, data, placement, placement);
+			timePatterns(runs, data, opts, flusher, team, re, false);
+
+			results[c].emplace_back();
+			for (auto& r : runs)
+				results[c].back().push_back(r.skipped ? 0 : summarize(r.samples, opts.rejectOutliers).median);
+		}
+	}
+
+	for (size_t j = 0; j < runs.size(); ++j) {
+		if (runs[j].skipped)
+			continue;
+		const double elements = (double)runs[j].pattern->size();
+		const double bytes = runs[j].pattern->bytesPerElement() * elements;
+
+		cout << "\n" << runs[j].info->name << " over " << formatSize(data.size() * sizeof(int))
+		     << ", ns/element (GB/s), CPU nodes down, memory nodes across:\n";
+		cout << setw(8) << "";
+		for (const auto& n : nodes)
+			cout << setw(18) << ("mem " + to_string(n.id));
+		cout << "\n";
+
+		for (size_t c = 0; c < nodes.size(); ++c) {
+			if (results[c].empty())
+				continue;
+			cout << setw(8) << ("cpu " + to_string(nodes[c].id));
+			for (size_t m = 0; m < nodes.size(); ++m) {
+				const double median = results[c][m][j];
+				ostringstream cell;
+				cell << fixed << setprecision(3) << median / elements
+				     << " (" << setprecision(2) << bytes / median << ")";
+				cout << setw(18) << cell.str();
+			}
+			cout << "\n";
+		}
+	}
+}
+
+// Times every pattern with its memory on regular pages,
+// and then again on the huge pages we were asked for,
+// so we can see how much of each pattern's time goes to TLB misses.
+void runPageCompare(const vector<PatternRun>& selected, const Options& opts,
+                    CacheFlusher& flusher, ThreadTeam& team, default_random_engine& re)
+{
+	const PageMode huge = opts.pages == PageMode::Small ? PageMode::Huge2M : opts.pages;
+
+	vector<vector<double>> medians; // [mode][pattern]
+	vector<bool> skipped(selected.size());
+	for (PageMode mode : { PageMode::Small, huge }) {
+		cout << "Timing with " << pageModeName(mode) << " pages...\r";
+		cout.flush();
+
+		pageMode() = mode;
+
+		// Start from scratch so that everything gets reallocated with the new pages.
+		vector<PatternRun> runs;
+		for (const auto& r : selected)
+			runs.push_back({r.info, r.info->create(opts.params), {}});
+
+		auto data = DataSet(max<size_t>(1, opts.dataSize / sizeof(int)));
+		setupPatterns(runs, data, opts);
+		timePatterns(runs, data, opts, flusher, team, re, false);
+
+		medians.emplace_back();
+		for (size_t j = 0; j < runs.size(); ++j) {
+			skipped[j] = skipped[j] || runs[j].skipped;
+			medians.back().push_back(runs[j].skipped ? 0 : summarize(runs[j].samples, opts.rejectOutliers).median);
+		}
+	}
+	pageMode() = opts.pages;
+
+	cout << "\nMedian times over a " << formatSize(opts.dataSize) << " data set:\n";
+	cout << setw(24) << "pattern" << setw(14) << "4k pages"
+	     << setw(14) << (string(pageModeName(huge)) + " pages") << setw(10) << "speedup" << "\n";
+	for (size_t j = 0; j < selected.size(); ++j) {
+		if (skipped[j])
+			continue;
+		cout << setw(24) << selected[j].info->name
+		     << setw(14) << formatTime(medians[0][j])
+		     << setw(14) << formatTime(medians[1][j])
+		     << setw(9) << setprecision(2) << medians[0][j] / medians[1][j] << "x\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options opts;
+	try {
+		opts = parseOptions(argc, argv);
+	}
+	catch (const invalid_argument& e) {
+		cerr << e.what() << "\n";
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	fileSettings() = { opts.file, opts.fileAdvice, opts.fileChunk };
+	if (!opts.file.empty() && !opts.iterationsSet)
+		opts.iterations = 5;
+
+	if (opts.help) {
+		printUsage(argv[0]);
+		return 0;
+	}
+
+	if (opts.list) {
+		for (const auto& p : patternRegistry()) {
+			cout << p.name << ": " << p.description;
+			if (!p.isSupported())
+				cout << " (not supported here)";
+			cout << "\n";
+		}
+		return 0;
+	}
+
+	// Patterns that give each thread something of its own make them up front.
+	// (--scaling goes up to a thread per CPU.)
+	opts.params.threads = opts.scaling ? max(opts.threads, availableCPUs().size()) : opts.threads;
+
+	vector<PatternRun> runs;
+	if (opts.patterns.empty()) {
+		// Skip whatever can't run here.
+		// Given a file, run just the patterns that read it.
+		for (const auto& p : patternRegistry()) {
+			if (!opts.file.empty() && p.supported != haveDataFile)
+				continue;
+			// Likewise, just the search patterns for --search-sweep
+			if (opts.searchSweep && p.name.compare(0, 7, "search-") != 0)
+				continue;
+			if (p.isSupported())
+				runs.push_back({&p, p.create(opts.params), {}});
+		}
+	}
+	else {
+		for (const auto& name : opts.patterns) {
+			const PatternInfo* p = findPattern(name);
+			if (p == nullptr) {
+				cerr << "No pattern named \"" << name << "\" (try --list)\n";
+				return 1;
+			}
+			if (!p->isSupported()) {
+				cerr << "The " << name << " pattern isn't supported on this machine\n";
+				return 1;
+			}
+			runs.push_back({p, p->create(opts.params), {}});
+		}
+	}
+
+	// Read the baseline up front, so we don't find out it's missing
+	// after running for an hour.
+	Baseline baseline;
+	if (!opts.baseline.empty()) {
+		try {
+			baseline = readBaseline(opts.baseline);
+		}
+		catch (const exception& e) {
+			cerr << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	const CacheTopology topology = detectCacheTopology();
+	printTopology(topology);
+
+	// Size the cache clearing and the data set from the topology
+	// unless we were told otherwise.
+	if (opts.cacheSize == 0)
+		opts.cacheSize = topology.totalDataSize();
+	if (opts.dataSize == 0)
+		opts.dataSize = topology.lastLevelSize() * 10;
+	if (!opts.tileSizeSet) {
+		if (const CacheLevel* l2 = topology.dataCache(2))
+			opts.params.tileSize = l2->size / 2;
+	}
+
+	pageMode() = opts.pages;
+	if (opts.pages != PageMode::Small)
+		cout << "Backing memory with " << pageModeName(opts.pages) << " pages\n";
+
+	CacheFlusher flusher(opts.flush, topology, opts.cacheSize);
+	cout << "Flushing with " << flushModeName(opts.flush) << " before each run\n";
+
+	const Timer& t = timer();
+	cout << "Timing with " << t.name() << " (resolution " << formatTime(t.resolutionNs()) << ")\n";
+
+	// Gather the program start time so we can tell how long it ran total.
+	const auto programStartTime = steady_clock::now();
+
+	// Used for populating our data set each time before we run.
+	// Unless we were given a seed, seed the RNG with actual hardware/OS randomness
+	// from random_device, but say what it was so the run can be repeated.
+	if (!opts.seedSet)
+		opts.seed = random_device()();
+	default_random_engine re((default_random_engine::result_type)opts.seed);
+	cout << "Seed " << opts.seed << " (rerun with --seed=" << opts.seed << " to repeat it)\n";
+
+	permutationCacheDir() = opts.permCache;
+
+	if (!opts.file.empty() && !ifstream(opts.file)) {
+		try {
+			createDataFile(opts.file, opts.dataSize, drawKey(re));
+		}
+		catch (const exception& e) {
+			cerr << e.what() << "\n";
+			return 1;
+		}
+		cout << "Created " << opts.file << " (" << formatSize(opts.dataSize) << " of random ints)\n";
+	}
+
+	cout << fixed;
+
+	// Results for --output and --baseline
+	vector<ResultRow> results;
+
+	if (opts.raisePriority) {
+		string error;
+		const string priority = raisePriority(error);
+		if (!priority.empty())
+			cout << "Running at " << priority << " priority\n";
+		else
+			cerr << "Warning: " << error << ", so running at normal priority\n";
+	}
+
+	try {
+		// Noise on the SMT sibling of the CPU the timed thread runs on
+		unique_ptr<NoiseThread> noise;
+		if (opts.smtNoise != NoiseKind::None) {
+			const int cpu = cpusToUse(opts).front();
+			const vector<int> siblings = smtSiblings(cpu);
+			if (siblings.empty()) {
+				cerr << "Warning: CPU " << cpu << " has no SMT sibling, so running without --smt-noise\n";
+			}
+			else {
+				const CacheLevel* l2 = topology.dataCache(2);
+				const size_t bytes = 2 * (l2 ? l2->size : 1024 * 1024);
+				noise.reset(new NoiseThread(opts.smtNoise, siblings.front(), bytes));
+				cout << "Running " << noiseKindName(opts.smtNoise) << " noise on CPU " << siblings.front()
+				     << ", CPU " << cpu << "'s SMT sibling\n";
+			}
+		}
+
+		if (opts.numaMatrix) {
+			runNumaMatrix(runs, opts, flusher, re);
+		}
+		else if (opts.scaling) {
+			runScaling(runs, opts, flusher, re);
+		}
+		else {
+			// Only pin threads if there's more than one of them,
+			// or if we were asked to run on a particular node or CPU.
+			const bool pin = opts.threads > 1 || opts.cpuNode >= 0 || opts.pinCpu >= 0 ||
+			                 opts.smtNoise != NoiseKind::None;
+			ThreadTeam team(opts.threads, pin ? cpusToUse(opts) : vector<int>());
+			if (opts.pageCompare)
+				runPageCompare(runs, opts, flusher, team, re);
+			else if (opts.prefetchSweep)
+				runPrefetchSweep(opts, flusher, team, re);
+			else if (opts.groupSweep)
+				runGroupSweep(opts, flusher, team, re);
+			else if (!opts.file.empty())
+				runFile(runs, opts, flusher, team, re, results);
+			else if (opts.searchSweep)
+				runSearchSweep(runs, opts, flusher, team, re, results);
+			else if (opts.sweep)
+				runSweep(runs, opts, flusher, team, re, results);
+			else
+				runOnce(runs, opts, flusher, team, re, results);
+		}
+
+		if (noise) {
+			cout << "\nThe " << noiseKindName(opts.smtNoise) << " noise managed " << setprecision(3)
+			     << noise->opsPerSecond() / 1e9 << " billion operations per second\n";
+		}
+	}
+	catch (const exception& e) {
+		cerr << "\nError: " << e.what() << "\n";
+		return 1;
+	}
+
+	const auto actualRuntime = duration<double>(steady_clock::now() - programStartTime).count();
+
+	cout << "\nRan for a total of " << setprecision(3) << actualRuntime
+	     << " seconds (including bookkeeping and cache flushing)\n";
+
+	if (!opts.output.empty() && results.empty())
+		cerr << "Warning: there were no results to write to " << opts.output << "\n";
+
+	if (!opts.output.empty() && !results.empty()) {
+		ofstream out(opts.output);
+		if (opts.format == "csv")
+			writeCSV(out, describeHost(topology), results);
+		else if (opts.format == "openmetrics")
+			writeOpenMetrics(out, describeHost(topology), results);
+		else
+			writeJSON(out, describeHost(topology), results);
+		if (!out) {
+			cerr << "Couldn't write the results to " << opts.output << "\n";
+			return 1;
+		}
+		cout << "Wrote the results to " << opts.output << "\n";
+	}
+
+	if (!baseline.empty()) {
+		size_t compared = 0;
+		const size_t regressions = compareToBaseline(cout, results, baseline, opts.threshold, &compared);
+		// Passing a check that didn't check anything would be worse than not having one.
+		if (compared == 0) {
+			cerr << "\nError: none of the results are in the baseline " << opts.baseline
+			     << " (which matches them by pattern, data set size, and threads)\n";
+			return 1;
+		}
+		if (regressions > 0) {
+			cout << regressions << (regressions == 1 ? " pattern" : " patterns")
+			     << " regressed\n";
+			return 2;
+		}
+	}
+	return 0;
+}
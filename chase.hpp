@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "patterns.hpp"
+
+// Pointer chasing: each element's successor is stored alongside it,
+// so we can't know where to load from next until the last load comes back.
+//
+// The shuffled-indirect walk jumps all over memory too, but its pointers are
+// all sitting in an array we read in order, so the out-of-order core can
+// have a dozen or so of those misses in flight at once. What it measures is
+// how many random loads per second the memory system can handle.
+// Here, every load waits for the one before it, like walking a linked list
+// or descending a tree, so what we measure is the full load-to-use latency
+// of whichever level of the hierarchy the data set fits in.
+
+// Walks the data set by following an array of 32-bit "next" indices.
+// If Shuffled is set, they form a random cycle through every element,
+// regenerated from a shuffled visit order before each run.
+// Otherwise, each element's successor is the one after it, which is still
+// a chain of dependent loads, but one the hardware prefetcher can follow.
+template <bool Shuffled>
+class ChasePattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		// The next indices are 32 bits, so the driver skips us past 2^32 elements.
+		if (d.size() > (size_t)std::numeric_limits<uint32_t>::max())
+			throw std::length_error("Pointer chasing patterns only support up to 2^32 elements");
+
+		data = &d;
+		checkpointInterval = std::max<size_t>(1, std::min<size_t>(256, d.size() / minCheckpoints));
+		next.resize(d.size());
+		for (size_t i = 0; i < d.size(); ++i)
+			next[i] = (uint32_t)((i + 1) % d.size());
+		checkpoints.resize((d.size() + checkpointInterval - 1) / checkpointInterval + 1);
+		for (size_t c = 0; c + 1 < checkpoints.size(); ++c)
+			checkpoints[c] = (uint32_t)(c * checkpointInterval);
+		// For ranges that start at the very end, which is back where we began
+		checkpoints.back() = 0;
+	}
+
+	void prepare(std::default_random_engine& re) override
+	{
+		if (!Shuffled)
+			return;
+
+		// A single cycle through every element, visiting them in a shuffled order.
+		// (Using the shuffle as the next indices themselves would give us
+		// a bunch of smaller cycles instead, and we'd spend the whole walk
+		// going around one of them.) Since we know the order, the checkpoints
+		// are just every so many entries of it, with no need to walk the cycle.
+		const size_t n = next.size();
+		const uint32_t* order = randomPermutation(n, re);
+		for (size_t k = 0; k + 1 < n; ++k)
+			next[order[k]] = order[k + 1];
+		next[order[n - 1]] = order[0];
+		for (size_t c = 0; c + 1 < checkpoints.size(); ++c)
+			checkpoints[c] = order[c * checkpointInterval];
+		checkpoints.back() = order[0];
+	}
+
+	size_t size() const override { return next.size(); }
+
+	// Walk positions [first, last) of the cycle, starting from the first checkpoint.
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		const int* d = data->data();
+		const uint32_t* n = next.data();
+
+		uint32_t i = elementAt(first);
+		uint64_t sum = 0;
+		for (size_t steps = last - first; steps > 0; --steps) {
+			const int64_t v = d[i];
+			sum += v * v;
+			i = n[i];
+		}
+		return sum;
+	}
+
+	double bytesPerElement() const override { return sizeof(int) + sizeof(uint32_t); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({next.data(), next.size() * sizeof(uint32_t)});
+		regions.push_back({checkpoints.data(), checkpoints.size() * sizeof(uint32_t)});
+	}
+
+protected:
+	// One walk is a single chain, so (for multithreaded runs) each thread
+	// needs somewhere in the middle of it to start from.
+	// We note where the walk is every 256 steps, or more often for
+	// data sets too small to have minCheckpoints of them that way,
+	// since the interleaved walks in interleave.hpp start each of their pieces
+	// at a checkpoint: this is enough for 256 pieces in each of four threads' shares.
+	// (Past that, they walk fewer pieces than --group asks for.)
+	static constexpr size_t minCheckpoints = 1024;
+	size_t checkpointInterval = 256;
+
+	const DataSet* data = nullptr;
+	PagedVector<uint32_t> next;
+	PagedVector<uint32_t> checkpoints; // Where the walk is at every checkpointInterval steps
+
+	// The element at the given position along the walk,
+	// catching up to it from the nearest checkpoint
+	uint32_t elementAt(size_t position) const
+	{
+		uint32_t i = checkpoints[position / checkpointInterval];
+		for (size_t skip = position % checkpointInterval; skip > 0; --skip)
+			i = next[i];
+		return i;
+	}
+};
+
+inline const RegisterPattern<ChasePattern<false>> registerSequentialChase(
+	"sequential-chase", "Follow a chain of next indices through the data set, in order");
+
+inline const RegisterPattern<ChasePattern<true>> registerShuffledChase(
+	"shuffled-chase", "Same, but the chain is a random cycle (dependent loads; true latency)");
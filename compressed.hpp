@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "gather.hpp"
+#include "patterns.hpp"
+#include "rng.hpp"
+#include "simd.hpp"
+
+// Compressed indices: is decoding cheaper than the memory it saves?
+//
+// A 64-bit pointer to a 4-byte int triples what the indirect walks read,
+// and 32-bit indices (see gather.hpp) only get that down to double.
+// But a sorted index (like a secondary index's list of matching rows)
+// can be stored as the gaps between its entries, which are small numbers
+// that pack into a few bits each.
+//
+// Each of these walks the same sorted index, of about one in every four
+// elements of the data set (picked by a fixed hash, so it's the same every run),
+// stored in a different way:
+//
+// - sparse-pointers: 64-bit pointers
+// - sparse-index: 32-bit indices
+// - sparse-index-avx2: the same, fetched with AVX2 gathers
+// - sparse-varint: the gaps as LEB128 varints (7 bits per byte, with the top bit
+//   saying whether another byte follows), which take a byte each here
+// - sparse-bitpacked: the gaps in blocks of 256, each packed into as many bits
+//   as the block's biggest gap needs (usually 4 or 5)
+// - sparse-bitpacked-avx2: the same, decoding eight at a time with AVX2,
+//   then fetching them with gathers (so compare it to sparse-index-avx2)
+//
+// The compressed ones are decoded a block at a time into a buffer (in L1)
+// of 32-bit indices, which is then walked just like sparse-index
+// (or sparse-index-avx2, for sparse-bitpacked-avx2).
+// Each block also notes where its first entry is, so threads can start
+// decoding anywhere, a block's worth of entries at most from where they want.
+
+namespace detail {
+
+// Entries per block, for the block-compressed indices
+constexpr size_t indexBlock = 256;
+
+// The sorted index these patterns walk: about a quarter of [0, n).
+// Its entries are 32-bit indices the gathers treat as signed, so past 2^31
+// elements this throws length_error, and the driver skips these patterns.
+inline std::vector<uint32_t> sparseSelection(size_t n)
+{
+	if (n > (size_t)std::numeric_limits<int32_t>::max())
+		throw std::length_error("Sparse index patterns only support up to 2^31 elements");
+
+	std::vector<uint32_t> selected;
+	selected.reserve(n / 4 + 1);
+	for (size_t i = 0; i < n; ++i) {
+		if ((kernels::mix32((uint32_t)i ^ 0x5bd1e995u) & 3) == 0)
+			selected.push_back((uint32_t)i);
+	}
+	if (selected.empty())
+		selected.push_back(0);
+	return selected;
+}
+
+// The index as pointers...
+class PointerEncoding {
+public:
+	void build(const std::vector<uint32_t>& index, int* data)
+	{
+		pointers.resize(index.size());
+		for (size_t i = 0; i < index.size(); ++i)
+			pointers[i] = data + index[i];
+	}
+
+	uint64_t sum(const int*, size_t first, size_t last) const
+	{
+		uint64_t sum = 0;
+		for (size_t i = first; i < last; ++i) {
+			const int64_t d = *pointers[i];
+			sum += d * d;
+		}
+		return sum;
+	}
+
+	size_t bytes() const { return pointers.size() * sizeof(int*); }
+	void regions(std::vector<MemoryRegion>& out) const { out.push_back({pointers.data(), bytes()}); }
+
+private:
+	PagedVector<int*> pointers;
+};
+
+// ...as indices, walked with the given kernel...
+template <IndexKernel K>
+class IndexEncoding {
+public:
+	void build(const std::vector<uint32_t>& index, int*)
+	{
+		indices.assign(index.begin(), index.end());
+	}
+
+	uint64_t sum(const int* data, size_t first, size_t last) const
+	{
+		return K(data, indices.data() + first, last - first);
+	}
+
+	size_t bytes() const { return indices.size() * sizeof(uint32_t); }
+	void regions(std::vector<MemoryRegion>& out) const { out.push_back({indices.data(), bytes()}); }
+
+private:
+	PagedVector<uint32_t> indices;
+};
+
+// Where a block of a compressed index starts
+struct IndexBlock {
+	uint32_t previous; // The entry before the block's first (the gaps start from here)
+	uint32_t offset; // Where its encoding starts (in bytes or words)
+	uint32_t width; // How many bits each of its gaps take (bit-packed only)
+};
+
+// ...as varints...
+class VarintEncoding {
+public:
+	void build(const std::vector<uint32_t>& index, int*)
+	{
+		std::vector<uint8_t> encoded;
+		blocks.clear();
+		uint32_t previous = 0;
+		for (size_t i = 0; i < index.size(); ++i) {
+			if (i % indexBlock == 0)
+				blocks.push_back({previous, (uint32_t)encoded.size(), 0});
+			uint32_t gap = index[i] - previous;
+			while (gap >= 0x80) {
+				encoded.push_back((uint8_t)(gap | 0x80));
+				gap >>= 7;
+			}
+			encoded.push_back((uint8_t)gap);
+			previous = index[i];
+		}
+		bytes_.assign(encoded.begin(), encoded.end());
+	}
+
+	uint64_t sum(const int* data, size_t first, size_t last) const
+	{
+		uint32_t decoded[indexBlock];
+		uint64_t sum = 0;
+		for (size_t b = first / indexBlock; b * indexBlock < last; ++b) {
+			const IndexBlock& block = blocks[b];
+			const size_t blockFirst = b * indexBlock;
+			const size_t count = std::min(indexBlock, last - blockFirst);
+
+			const uint8_t* p = bytes_.data() + block.offset;
+			uint32_t entry = block.previous;
+			for (size_t i = 0; i < count; ++i) {
+				uint32_t gap = 0;
+				unsigned int shift = 0;
+				uint8_t byte;
+				do {
+					byte = *p++;
+					gap |= (uint32_t)(byte & 0x7f) << shift;
+					shift += 7;
+				} while (byte & 0x80);
+				entry += gap;
+				decoded[i] = entry;
+			}
+
+			const size_t skip = first > blockFirst ? first - blockFirst : 0;
+			sum += kernels::sumSquaresIndexed(data, decoded + skip, count - skip);
+		}
+		return sum;
+	}
+
+	size_t bytes() const { return bytes_.size() + blocks.size() * sizeof(IndexBlock); }
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		out.push_back({bytes_.data(), bytes_.size()});
+		out.push_back({blocks.data(), blocks.size() * sizeof(IndexBlock)});
+	}
+
+private:
+	PagedVector<uint8_t> bytes_;
+	std::vector<IndexBlock> blocks;
+};
+
+// ...or bit-packed.
+//
+// Each block's gaps are split between eight lanes, so that gap i is in lane i % 8,
+// and each lane's 32 gaps are packed one after the other, from the bottom bit up,
+// into `width` 32-bit words. The lanes' words are interleaved, so word k of
+// every lane is in one 32-byte chunk, which is exactly one AVX2 register:
+// unpacking gap j of every lane at once is the same shifts and masks on all of them.
+// (This is the "vertical" layout of Lemire and Boytsov's SIMD-BP128.)
+template <bool AVX2>
+class PackedEncoding {
+public:
+	void build(const std::vector<uint32_t>& index, int*)
+	{
+		std::vector<uint32_t> words;
+		blocks.clear();
+		uint32_t previous = 0;
+		for (size_t first = 0; first < index.size(); first += indexBlock) {
+			const size_t count = std::min(indexBlock, index.size() - first);
+			uint32_t gaps[indexBlock] = {};
+			uint32_t biggest = 0;
+			uint32_t p = previous;
+			for (size_t i = 0; i < count; ++i) {
+				gaps[i] = index[first + i] - p;
+				p = index[first + i];
+				biggest = std::max(biggest, gaps[i]);
+			}
+
+			uint32_t width = 0;
+			while (width < 32 && (biggest >> width) != 0)
+				++width;
+			blocks.push_back({previous, (uint32_t)words.size(), width});
+
+			const size_t start = words.size();
+			words.resize(start + 8 * width);
+			for (size_t i = 0; i < indexBlock && width > 0; ++i) {
+				const size_t lane = i % 8;
+				const size_t bit = (i / 8) * width;
+				uint32_t* word = &words[start + (bit / 32) * 8 + lane];
+				word[0] |= gaps[i] << (bit % 32);
+				if (bit % 32 + width > 32)
+					word[8] |= gaps[i] >> (32 - bit % 32);
+			}
+			previous = p;
+		}
+		words_.assign(words.begin(), words.end());
+	}
+
+	uint64_t sum(const int* data, size_t first, size_t last) const
+	{
+		alignas(32) uint32_t decoded[indexBlock];
+		uint64_t sum = 0;
+		for (size_t b = first / indexBlock; b * indexBlock < last; ++b) {
+			const size_t blockFirst = b * indexBlock;
+			const size_t count = std::min(indexBlock, last - blockFirst);
+			const size_t skip = first > blockFirst ? first - blockFirst : 0;
+#ifdef CACHE_DEMO_X86
+			if (AVX2) {
+				decodeAVX2(blocks[b], decoded);
+				sum += kernels::sumSquaresGatherAVX2(data, decoded + skip, count - skip);
+				continue;
+			}
+#endif
+			decode(blocks[b], decoded);
+			sum += kernels::sumSquaresIndexed(data, decoded + skip, count - skip);
+		}
+		return sum;
+	}
+
+	size_t bytes() const { return words_.size() * sizeof(uint32_t) + blocks.size() * sizeof(IndexBlock); }
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		out.push_back({words_.data(), words_.size() * sizeof(uint32_t)});
+		out.push_back({blocks.data(), blocks.size() * sizeof(IndexBlock)});
+	}
+
+private:
+	PagedVector<uint32_t> words_;
+	std::vector<IndexBlock> blocks;
+
+	// Decodes a whole block (past the end of the index, the gaps are zeros)
+	void decode(const IndexBlock& block, uint32_t* out) const
+	{
+		const uint32_t* words = words_.data() + block.offset;
+		const uint32_t mask = block.width == 32 ? ~0u : (1u << block.width) - 1;
+		uint32_t entry = block.previous;
+		for (size_t i = 0; i < indexBlock; ++i) {
+			const size_t bit = (i / 8) * block.width;
+			const uint32_t* word = words + (bit / 32) * 8 + i % 8;
+			uint32_t gap = block.width == 0 ? 0 : word[0] >> (bit % 32);
+			if (bit % 32 + block.width > 32)
+				gap |= word[8] << (32 - bit % 32);
+			entry += gap & mask;
+			out[i] = entry;
+		}
+	}
+
+#ifdef CACHE_DEMO_X86
+	__attribute__((target("avx2")))
+	void decodeAVX2(const IndexBlock& block, uint32_t* out) const
+	{
+		const __m256i* words = (const __m256i*)(words_.data() + block.offset);
+		const __m256i mask = _mm256_set1_epi32(block.width == 32 ? -1 : (int)((1u << block.width) - 1));
+		__m256i running = _mm256_set1_epi32((int)block.previous);
+
+		for (size_t j = 0; j < indexBlock / 8; ++j) {
+			// Gap j of every lane
+			__m256i gaps = _mm256_setzero_si256();
+			if (block.width > 0) {
+				const size_t bit = j * block.width;
+				const unsigned int shift = bit % 32;
+				gaps = _mm256_srl_epi32(_mm256_loadu_si256(words + bit / 32), _mm_cvtsi32_si128((int)shift));
+				if (shift + block.width > 32) {
+					const __m256i high = _mm256_loadu_si256(words + bit / 32 + 1);
+					gaps = _mm256_or_si256(gaps, _mm256_sll_epi32(high, _mm_cvtsi32_si128((int)(32 - shift))));
+				}
+				gaps = _mm256_and_si256(gaps, mask);
+			}
+
+			// Prefix sum over the eight lanes: within each half...
+			gaps = _mm256_add_epi32(gaps, _mm256_slli_si256(gaps, 4));
+			gaps = _mm256_add_epi32(gaps, _mm256_slli_si256(gaps, 8));
+			// ...then carry the low half's total into the high half...
+			const __m256i top = _mm256_shuffle_epi32(gaps, 0xff);
+			const __m256i lowTotal = _mm256_permute2x128_si256(top, top, 0x08);
+			gaps = _mm256_add_epi32(gaps, lowTotal);
+			// ...and add it all to where the last group left off.
+			const __m256i entries = _mm256_add_epi32(gaps, running);
+			_mm256_store_si256((__m256i*)(out + 8 * j), entries);
+			running = _mm256_permutevar8x32_epi32(entries, _mm256_set1_epi32(7));
+		}
+	}
+#endif
+};
+
+} // namespace detail
+
+// Walks the sparse index, stored with the given encoding,
+// which needs build(index, data), sum(data, first, last), bytes() (how much
+// memory it takes up), and regions(out) (where that memory is).
+template <typename Encoding>
+class SparseIndexPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		const std::vector<uint32_t> index = detail::sparseSelection(d.size());
+		entries = index.size();
+		encoding.build(index, d.data());
+	}
+
+	size_t size() const override { return entries; }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		return encoding.sum(data->data(), first, last);
+	}
+
+	double bytesPerElement() const override { return sizeof(int) + (double)encoding.bytes() / entries; }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		encoding.regions(regions);
+	}
+
+private:
+	const DataSet* data = nullptr;
+	size_t entries = 0;
+	Encoding encoding;
+};
+
+inline const RegisterPattern<SparseIndexPattern<detail::PointerEncoding>> registerSparsePointers(
+	"sparse-pointers", "Walk a sorted index of a quarter of the data set, as pointers");
+inline const RegisterPattern<SparseIndexPattern<detail::IndexEncoding<kernels::sumSquaresIndexed>>> registerSparseIndex(
+	"sparse-index", "Same, as 32-bit indices");
+inline const RegisterPattern<SparseIndexPattern<detail::VarintEncoding>> registerSparseVarint(
+	"sparse-varint", "Same, as the gaps between entries, in varints");
+inline const RegisterPattern<SparseIndexPattern<detail::PackedEncoding<false>>> registerSparsePacked(
+	"sparse-bitpacked", "Same, as the gaps between entries, bit-packed in blocks");
+
+#ifdef CACHE_DEMO_X86
+inline const RegisterPattern<SparseIndexPattern<detail::IndexEncoding<kernels::sumSquaresGatherAVX2>>>
+	registerSparseIndexAVX2("sparse-index-avx2", "Sparse-index, with AVX2 gathers", kernels::haveAVX2);
+inline const RegisterPattern<SparseIndexPattern<detail::PackedEncoding<true>>> registerSparsePackedAVX2(
+	"sparse-bitpacked-avx2", "Sparse-bitpacked, unpacked and gathered with AVX2", kernels::haveAVX2);
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Which CPUs we can run on, and getting threads onto them.
+
+// Returns the CPUs the calling thread is allowed to run on, in order.
+// If we can't tell, assumes all of them.
+inline std::vector<int> availableCPUs()
+{
+	std::vector<int> cpus;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int i = 0; i < CPU_SETSIZE; ++i) {
+			if (CPU_ISSET(i, &set))
+				cpus.push_back(i);
+		}
+	}
+#endif
+	if (cpus.empty()) {
+		const unsigned int n = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned int i = 0; i < n; ++i)
+			cpus.push_back((int)i);
+	}
+	return cpus;
+}
+
+// The CPUs the process could run on when it started, before we pinned anything.
+// Threads inherit whichever CPUs the thread that starts them is pinned to,
+// so helpers that want to spread out (see fillRandomParallel()) need this.
+inline const std::vector<int> processCPUs = availableCPUs();
+
+// Pins the calling thread to the given CPU. Returns false if we couldn't.
+inline bool pinThisThread(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+// Lets the calling thread run on any of the given CPUs. Returns false if we couldn't.
+inline bool allowThisThread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+		CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpus;
+	return false;
+#endif
+}
@@ -0,0 +1,749 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "memory.hpp"
+#include "patterns.hpp"
+#include "rng.hpp"
+#include "simd.hpp"
+#include "threads.hpp"
+
+// Data sets on disk, for scans over files too big to fit in memory.
+//
+// With --file, these read the file's ints instead of the in-memory data set,
+// doing the same sum of squares over them. Before every run, we drop the
+// file from the page cache (see evict()), so each run reads it from the device.
+// The file is walked a chunk (--file-chunk, 1M by default) at a time,
+// either in order or with the chunks shuffled before each run.
+//
+// - file-mmap maps the file and lets page faults (and the kernel's readahead)
+//   bring it in, as told by --file-advice: madvise()'s MADV_SEQUENTIAL or
+//   MADV_RANDOM for the whole mapping, or MADV_WILLNEED for each chunk
+//   while we sum the one before it.
+// - file-read reads each chunk into a buffer with pread(), then sums it,
+//   so the device and the CPU take turns.
+// - file-stream double-buffers: it asks for the next chunk before summing the
+//   one it has, so the I/O overlaps the work. The reads go through io_uring
+//   (set up with raw syscalls, so there's no liburing to install),
+//   or if the kernel won't let us have one (seccomp in containers often doesn't),
+//   through pread() on another thread.
+//
+// deviceReadBandwidth() (below) measures what the device can do
+// with nothing else going on, to compare these against.
+
+// Which madvise() advice file-mmap gives
+enum class FileAdvice {
+	Normal,
+	Sequential,
+	Random,
+	WillNeed,
+};
+
+inline const char* fileAdviceName(FileAdvice a)
+{
+	switch (a) {
+		case FileAdvice::Normal: return "normal";
+		case FileAdvice::Sequential: return "sequential";
+		case FileAdvice::Random: return "random";
+		case FileAdvice::WillNeed: return "willneed";
+	}
+	return "?";
+}
+
+// The file the file patterns read, set from the command line
+struct FileSettings {
+	std::string path; // Empty if there isn't one
+	FileAdvice advice = FileAdvice::Normal;
+	size_t chunkSize = 1024 * 1024; // In bytes; rounded up to a whole number of pages
+};
+
+inline FileSettings& fileSettings()
+{
+	static FileSettings settings;
+	return settings;
+}
+
+// Whether the file patterns have a file to read
+inline bool haveDataFile()
+{
+#ifdef __linux__
+	return !fileSettings().path.empty();
+#else
+	return false;
+#endif
+}
+
+#ifdef __linux__
+
+namespace detail {
+
+[[noreturn]] inline void throwFileError(const std::string& what)
+{
+	throw std::runtime_error(what + " " + fileSettings().path + ": " + strerror(errno));
+}
+
+inline size_t roundToPages(size_t bytes)
+{
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return std::max(page, (bytes + page - 1) / page * page);
+}
+
+// Reads exactly n bytes at the given offset (or up to the end of the file)
+inline void readFully(int fd, void* out, size_t n, off_t offset)
+{
+	uint8_t* p = (uint8_t*)out;
+	while (n > 0) {
+		const ssize_t got = pread(fd, p, n, offset);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			throwFileError("Couldn't read");
+		if (got == 0)
+			return;
+		p += got;
+		n -= (size_t)got;
+		offset += got;
+	}
+}
+
+// One io_uring, with just enough of it for one read at a time.
+class Uring {
+public:
+	Uring()
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		fd = (int)syscall(__NR_io_uring_setup, 4, &params);
+		if (fd < 0)
+			return;
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		              fd, IORING_OFF_SQ_RING);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			cqRing = sqRing;
+		else
+			cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			              fd, IORING_OFF_CQ_RING);
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+		                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+			release();
+			return;
+		}
+
+		uint8_t* sq = (uint8_t*)sqRing;
+		sqTail = (unsigned*)(sq + params.sq_off.tail);
+		sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+		sqArray = (unsigned*)(sq + params.sq_off.array);
+		uint8_t* cq = (uint8_t*)cqRing;
+		cqHead = (unsigned*)(cq + params.cq_off.head);
+		cqTail = (unsigned*)(cq + params.cq_off.tail);
+		cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+	}
+
+	Uring(const Uring&) = delete;
+	Uring& operator=(const Uring&) = delete;
+
+	~Uring() { release(); }
+
+	bool ok() const { return fd >= 0; }
+
+	// Asks for a read of n bytes at the given offset. The buffer (and the iovec)
+	// must stay put until wait() says it's done.
+	bool submitRead(int file, iovec* iov, off_t offset)
+	{
+		const unsigned tail = *sqTail;
+		const unsigned index = tail & *sqMask;
+		io_uring_sqe* sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READV; // Plain IORING_OP_READ needs Linux 5.6
+		sqe->fd = file;
+		sqe->addr = (uint64_t)(uintptr_t)iov;
+		sqe->len = 1;
+		sqe->off = (uint64_t)offset;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		return syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) == 1;
+	}
+
+	// Waits for the read to finish, returning how many bytes it got (or -errno).
+	int wait()
+	{
+		for (;;) {
+			const unsigned head = *cqHead;
+			if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+				const int result = cqes[head & *cqMask].res;
+				__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+				return result;
+			}
+			if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+			    errno != EINTR)
+				return -errno;
+		}
+	}
+
+private:
+	int fd = -1;
+	void* sqRing = MAP_FAILED;
+	void* cqRing = MAP_FAILED;
+	size_t sqRingSize = 0;
+	size_t cqRingSize = 0;
+	io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+	size_t sqesSize = 0;
+
+	unsigned* sqTail = nullptr;
+	unsigned* sqMask = nullptr;
+	unsigned* sqArray = nullptr;
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned* cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+
+	void release()
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize);
+		if (cqRing != MAP_FAILED && cqRing != sqRing)
+			munmap(cqRing, cqRingSize);
+		if (sqRing != MAP_FAILED)
+			munmap(sqRing, sqRingSize);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		sqRing = cqRing = MAP_FAILED;
+		sqes = (io_uring_sqe*)MAP_FAILED;
+	}
+};
+
+// Every file-mmap pattern's mapping of the file.
+// The page cache can't drop pages that anyone has mapped,
+// so evicting the file means dropping them from all of these first.
+inline std::vector<MemoryRegion>& fileMappings()
+{
+	static std::vector<MemoryRegion> mappings;
+	return mappings;
+}
+
+// Whether we can use io_uring here (we only try once)
+inline bool haveUring()
+{
+	static const bool have = Uring().ok();
+	return have;
+}
+
+// A thread that does one pread() at a time for another, for file-stream
+// when we can't have io_uring. It's started once, up front, so the timed runs
+// don't start a thread for every chunk. Between begin() and end() (i.e., during
+// a run), it spins waiting for the next read, so each one starts as soon as it's
+// asked for; the rest of the time, it sleeps, so it doesn't take a CPU from
+// whatever else we're timing.
+class ReaderThread {
+public:
+	ReaderThread() : thread([this] { work(); }) {}
+
+	~ReaderThread()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			active.store(false, std::memory_order_relaxed);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+
+	ReaderThread(const ReaderThread&) = delete;
+	ReaderThread& operator=(const ReaderThread&) = delete;
+
+	void begin()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			active.store(true, std::memory_order_release);
+		}
+		wake.notify_one();
+	}
+
+	// Waits for any read that's still going, then lets the thread sleep again.
+	void end()
+	{
+		unsigned int spins = 0;
+		while (pending.load(std::memory_order_acquire))
+			spinPause(spins);
+		active.store(false, std::memory_order_release);
+	}
+
+	// Starts reading n bytes at the given offset into out (see readFully()).
+	void read(int fd, void* out, size_t n, off_t offset)
+	{
+		request = {fd, out, n, offset};
+		pending.store(true, std::memory_order_release);
+	}
+
+	// Waits for the last read() to finish, throwing whatever it threw.
+	void wait()
+	{
+		unsigned int spins = 0;
+		while (pending.load(std::memory_order_acquire))
+			spinPause(spins);
+		if (error) {
+			const std::exception_ptr e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+private:
+	struct Request {
+		int fd;
+		void* out;
+		size_t n;
+		off_t offset;
+	};
+
+	Request request = {};
+	std::exception_ptr error;
+	std::atomic<bool> pending{false};
+	std::atomic<bool> active{false};
+	bool stopping = false;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread thread; // Last, so everything else is ready before it starts
+
+	void work()
+	{
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [this] { return stopping || active.load(std::memory_order_relaxed); });
+				if (stopping)
+					return;
+			}
+			unsigned int spins = 0;
+			while (active.load(std::memory_order_acquire)) {
+				if (!pending.load(std::memory_order_acquire)) {
+					spinPause(spins);
+					continue;
+				}
+				try {
+					readFully(request.fd, request.out, request.n, request.offset);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+				pending.store(false, std::memory_order_release);
+				spins = 0;
+			}
+		}
+	}
+};
+
+} // namespace detail
+
+// How file-stream reads: "io_uring" or "pread() on a reader thread"
+inline const char* streamingMethod()
+{
+	return detail::haveUring() ? "io_uring" : "pread() on a reader thread";
+}
+
+// Creates the data file, bytes long, filled with the same kind of values
+// as the data set (derived from the key; see rng.hpp).
+inline void createDataFile(const std::string& path, size_t bytes, uint64_t key)
+{
+	const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0)
+		detail::throwFileError("Couldn't create");
+
+	const size_t chunk = 16 * 1024 * 1024 / sizeof(int);
+	std::vector<int> values(chunk);
+	size_t remaining = bytes / sizeof(int);
+	for (size_t c = 0; remaining > 0; ++c) {
+		const size_t n = std::min(chunk, remaining);
+		fillRandomParallel(values.data(), n, key ^ (c * 0x9e3779b97f4a7c15ull), 1, 10);
+		const uint8_t* p = (const uint8_t*)values.data();
+		size_t left = n * sizeof(int);
+		while (left > 0) {
+			const ssize_t wrote = write(fd, p, left);
+			if (wrote < 0 && errno == EINTR)
+				continue;
+			if (wrote < 0) {
+				close(fd);
+				detail::throwFileError("Couldn't write");
+			}
+			p += wrote;
+			left -= (size_t)wrote;
+		}
+		remaining -= n;
+	}
+	// Make sure it's all on the device, so the page cache can drop it.
+	if (fsync(fd) != 0 || close(fd) != 0)
+		detail::throwFileError("Couldn't write");
+}
+
+// Drops the file from the page cache, then times reading it from front to back,
+// a chunk at a time into the same buffer (doing nothing with the data),
+// and returns the best of a few tries in GB/s.
+inline double deviceReadBandwidth()
+{
+	const FileSettings& settings = fileSettings();
+	const int fd = open(settings.path.c_str(), O_RDONLY);
+	if (fd < 0)
+		detail::throwFileError("Couldn't open");
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		detail::throwFileError("Couldn't stat");
+	}
+
+	const size_t chunk = detail::roundToPages(settings.chunkSize);
+	PagedVector<uint8_t> buffer(chunk);
+	double best = 0;
+	for (int attempt = 0; attempt < 3; ++attempt) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		const auto start = std::chrono::steady_clock::now();
+		for (off_t offset = 0; offset < st.st_size; offset += (off_t)chunk)
+			detail::readFully(fd, buffer.data(), chunk, offset);
+		const double seconds =
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		best = std::max(best, st.st_size / seconds / 1e9);
+	}
+	close(fd);
+	return best;
+}
+
+// What the file patterns have in common:
+// the file, its chunks, and the order to read them in.
+template <bool Shuffled>
+class FilePattern : public AccessPattern {
+public:
+	explicit FilePattern(const PatternParams& params) : scratch(params.threads) {}
+	FilePattern(const FilePattern&) = delete;
+	FilePattern& operator=(const FilePattern&) = delete;
+
+	~FilePattern() override
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+
+	// The data set is ignored; we have the file instead.
+	void setup(DataSet&) override
+	{
+		if (fd < 0) {
+			fd = open(fileSettings().path.c_str(), O_RDONLY);
+			if (fd < 0)
+				detail::throwFileError("Couldn't open");
+			struct stat st;
+			if (fstat(fd, &st) != 0)
+				detail::throwFileError("Couldn't stat");
+			bytes = (size_t)st.st_size;
+		}
+		if (bytes < sizeof(int))
+			throw std::runtime_error(fileSettings().path + " is empty");
+
+		kernel = bestSumSquaresKernel();
+		chunkElements = detail::roundToPages(fileSettings().chunkSize) / sizeof(int);
+		order.resize((size() + chunkElements - 1) / chunkElements);
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		// A thread's share of the walk never covers more pieces than there are chunks.
+		for (auto& s : scratch)
+			s.reserve(order.size());
+	}
+
+	// A partial chunk at the end always stays there,
+	// so that every other position in the walk is a whole chunk.
+	void prepare(std::default_random_engine& re) override
+	{
+		if (Shuffled && order.size() > 1) {
+			const bool partial = size() % chunkElements != 0;
+			std::shuffle(order.begin(), order.end() - (partial ? 1 : 0), re);
+		}
+	}
+
+	size_t size() const override { return bytes / sizeof(int); }
+
+	void evict() override
+	{
+		for (const auto& m : detail::fileMappings())
+			madvise(const_cast<void*>(m.start), m.size, MADV_DONTNEED);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+
+protected:
+	int fd = -1;
+	size_t bytes = 0;
+	size_t chunkElements = 0;
+	std::vector<size_t> order; // Which chunk to read at each step
+	SumSquaresKernel kernel = nullptr;
+
+	// A contiguous piece of the file, in elements
+	struct Piece {
+		size_t first;
+		size_t count;
+	};
+	mutable std::vector<std::vector<Piece>> scratch; // For pieces(), one per thread (by teamMember())
+
+	// The pieces of the file that positions [first, last) of the walk cover,
+	// in the calling thread's scratch space, which setup() made big enough
+	// that the timed calls never allocate. They're valid until its next call.
+	const std::vector<Piece>& pieces(size_t first, size_t last) const
+	{
+		std::vector<Piece>& out = scratch[teamMember()];
+		out.clear();
+		while (first < last) {
+			const size_t chunk = order[first / chunkElements];
+			const size_t offset = first % chunkElements;
+			const size_t chunkStart = chunk * chunkElements;
+			const size_t n = std::min(last - first, std::min(chunkElements, size() - chunkStart) - offset);
+			out.push_back({chunkStart + offset, n});
+			first += n;
+		}
+		return out;
+	}
+};
+
+template <bool Shuffled>
+class FileMapPattern : public FilePattern<Shuffled> {
+public:
+	explicit FileMapPattern(const PatternParams& params) : FilePattern<Shuffled>(params) {}
+	~FileMapPattern() override { unmap(); }
+
+	void setup(DataSet& d) override
+	{
+		FilePattern<Shuffled>::setup(d);
+		unmap();
+		map();
+	}
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		const bool willNeed = fileSettings().advice == FileAdvice::WillNeed;
+		const auto& pieces = this->pieces(first, last);
+		uint64_t sum = 0;
+		for (size_t i = 0; i < pieces.size(); ++i) {
+			if (willNeed && i + 1 < pieces.size())
+				advise(pieces[i + 1], MADV_WILLNEED);
+			sum += this->kernel(values + pieces[i].first, pieces[i].count);
+		}
+		return sum;
+	}
+
+private:
+	void* mapping = MAP_FAILED;
+	size_t mappedBytes = 0;
+	const int* values = nullptr;
+
+	void map()
+	{
+		mappedBytes = this->bytes;
+		mapping = mmap(nullptr, mappedBytes, PROT_READ, MAP_SHARED, this->fd, 0);
+		if (mapping == MAP_FAILED)
+			detail::throwFileError("Couldn't map");
+		values = (const int*)mapping;
+		detail::fileMappings().push_back({mapping, mappedBytes});
+
+		switch (fileSettings().advice) {
+			case FileAdvice::Sequential: madvise(mapping, mappedBytes, MADV_SEQUENTIAL); break;
+			case FileAdvice::Random: madvise(mapping, mappedBytes, MADV_RANDOM); break;
+			default: break;
+		}
+	}
+
+	void unmap()
+	{
+		if (mapping == MAP_FAILED)
+			return;
+		auto& mappings = detail::fileMappings();
+		mappings.erase(std::remove_if(mappings.begin(), mappings.end(),
+			[this](const MemoryRegion& m) { return m.start == mapping; }), mappings.end());
+		munmap(mapping, mappedBytes);
+		mapping = MAP_FAILED;
+	}
+
+	// madvise() wants a page-aligned start
+	void advise(const typename FilePattern<Shuffled>::Piece& piece, int advice) const
+	{
+		const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+		const uintptr_t start = (uintptr_t)(values + piece.first) & ~(page - 1);
+		const uintptr_t end = (uintptr_t)(values + piece.first + piece.count);
+		madvise((void*)start, end - start, advice);
+	}
+};
+
+// Reads the file into buffers, either one chunk at a time
+// or (if Overlapped) reading the next while summing the last.
+template <bool Shuffled, bool Overlapped>
+class FileReadPattern : public FilePattern<Shuffled> {
+public:
+	explicit FileReadPattern(const PatternParams& params) :
+		FilePattern<Shuffled>(params), readers(params.threads) {}
+
+	// Each thread gets buffers (and an io_uring, or a reader thread) of its own,
+	// made up front, so that the timed calls don't pay for mapping (and faulting in)
+	// new ones, or for starting threads.
+	void setup(DataSet& d) override
+	{
+		FilePattern<Shuffled>::setup(d);
+		for (auto& r : readers) {
+			r.buffers[0].assign(this->chunkElements, 0);
+			if (Overlapped)
+				r.buffers[1].assign(this->chunkElements, 0);
+			if (Overlapped && detail::haveUring() && !r.ring)
+				r.ring.reset(new detail::Uring);
+			if (Overlapped && !detail::haveUring() && !r.thread)
+				r.thread.reset(new detail::ReaderThread);
+		}
+	}
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		for (const auto& r : readers) {
+			for (const auto& b : r.buffers) {
+				if (!b.empty())
+					regions.push_back({b.data(), b.size() * sizeof(int)});
+			}
+		}
+	}
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		const auto& pieces = this->pieces(first, last);
+		if (pieces.empty())
+			return 0;
+		Reader& reader = readers[teamMember()];
+		auto& buffers = reader.buffers;
+
+		uint64_t sum = 0;
+		if (!Overlapped) {
+			for (const auto& p : pieces) {
+				detail::readFully(this->fd, buffers[0].data(), p.count * sizeof(int), offsetOf(p));
+				sum += this->kernel(buffers[0].data(), p.count);
+			}
+			return sum;
+		}
+
+		if (reader.ring) {
+			detail::Uring& ring = *reader.ring;
+			iovec iov[2];
+			auto submit = [&](size_t i) {
+				iov[i % 2] = {buffers[i % 2].data(), pieces[i].count * sizeof(int)};
+				if (!ring.submitRead(this->fd, &iov[i % 2], offsetOf(pieces[i])))
+					detail::throwFileError("io_uring couldn't read");
+			};
+
+			submit(0);
+			for (size_t i = 0; i < pieces.size(); ++i) {
+				const int got = ring.wait();
+				if (got < 0) {
+					errno = -got;
+					detail::throwFileError("io_uring couldn't read");
+				}
+				// Short reads are rare, but not impossible.
+				const size_t wanted = pieces[i].count * sizeof(int);
+				if ((size_t)got < wanted) {
+					detail::readFully(this->fd, (uint8_t*)buffers[i % 2].data() + got,
+					                  wanted - got, offsetOf(pieces[i]) + got);
+				}
+				if (i + 1 < pieces.size())
+					submit(i + 1);
+				sum += this->kernel(buffers[i % 2].data(), pieces[i].count);
+			}
+			return sum;
+		}
+
+		detail::ReaderThread& helper = *reader.thread;
+		auto read = [&](size_t i) {
+			helper.read(this->fd, buffers[i % 2].data(), pieces[i].count * sizeof(int), offsetOf(pieces[i]));
+		};
+		// Let the helper sleep again, however we leave.
+		struct Session {
+			detail::ReaderThread& helper;
+			~Session() { helper.end(); }
+		} session{helper};
+		helper.begin();
+		read(0);
+		for (size_t i = 0; i < pieces.size(); ++i) {
+			helper.wait();
+			if (i + 1 < pieces.size())
+				read(i + 1);
+			sum += this->kernel(buffers[i % 2].data(), pieces[i].count);
+		}
+		return sum;
+	}
+
+private:
+	// What one thread reads with
+	struct Reader {
+		PagedVector<int> buffers[2]; // Only the first, unless Overlapped
+		std::unique_ptr<detail::Uring> ring; // If Overlapped and we have io_uring
+		std::unique_ptr<detail::ReaderThread> thread; // If Overlapped and we don't
+	};
+	// One per thread, indexed by teamMember()
+	mutable std::vector<Reader> readers;
+
+	static off_t offsetOf(const typename FilePattern<Shuffled>::Piece& p)
+	{
+		return (off_t)(p.first * sizeof(int));
+	}
+};
+
+inline const RegisterPattern<FileMapPattern<false>> registerFileMap(
+	"file-mmap", "Sum squares of --file, mapped with mmap() (and --file-advice)", haveDataFile);
+inline const RegisterPattern<FileMapPattern<true>> registerFileMapShuffled(
+	"file-mmap-shuffled", "Same, a chunk at a time in shuffled order", haveDataFile);
+inline const RegisterPattern<FileReadPattern<false, false>> registerFileRead(
+	"file-read", "Sum squares of --file, reading a chunk, then summing it", haveDataFile);
+inline const RegisterPattern<FileReadPattern<false, true>> registerFileStream(
+	"file-stream", "Same, reading the next chunk (with io_uring) while summing the last", haveDataFile);
+inline const RegisterPattern<FileReadPattern<true, true>> registerFileStreamShuffled(
+	"file-stream-shuffled", "Same, with the chunks in shuffled order", haveDataFile);
+
+#else
+
+// Elsewhere, there are no file patterns to run.
+
+inline const char* streamingMethod() { return "nothing"; }
+
+inline void createDataFile(const std::string&, size_t, uint64_t)
+{
+	throw std::runtime_error("--file is only supported on Linux");
+}
+
+inline double deviceReadBandwidth()
+{
+	throw std::runtime_error("--file is only supported on Linux");
+}
+
+#endif // __linux__
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "topology.hpp"
+
+// A chunk of memory a pattern reads, which we might want to flush
+struct MemoryRegion {
+	const void* start;
+	size_t size; // In bytes
+};
+
+// The ways we can get rid of (or keep!) cached data between runs
+enum class FlushMode {
+	None, // Leave everything in cache, to measure warm performance
+	Copy, // Copy a cache-sized buffer (the original, brute force approach)
+	Clflush, // Flush each line of the data with clflushopt (or clflush)
+	Stream, // Rewrite each line of the data with non-temporal stores (so it has to be writable)
+	L2, // Evict the data from L1 and L2, but leave it in L3
+};
+
+inline const char* flushModeName(FlushMode m)
+{
+	switch (m) {
+		case FlushMode::None: return "none";
+		case FlushMode::Copy: return "copy";
+		case FlushMode::Clflush: return "clflush";
+		case FlushMode::Stream: return "stream";
+		case FlushMode::L2: return "l2";
+	}
+	return "?";
+}
+
+// Throws invalid_argument if the name isn't one of the above
+inline FlushMode parseFlushMode(const std::string& name)
+{
+	for (FlushMode m : { FlushMode::None, FlushMode::Copy, FlushMode::Clflush,
+	                     FlushMode::Stream, FlushMode::L2 }) {
+		if (name == flushModeName(m))
+			return m;
+	}
+	throw std::invalid_argument("Unknown flush mode \"" + name + "\"");
+}
+
+namespace detail {
+
+#if defined(__x86_64__) || defined(__i386__)
+
+inline bool haveClflushopt()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ebx & bit_CLFLUSHOPT) != 0;
+}
+
+// Unlike clflush, clflushopt isn't ordered with respect to other flushes,
+// so a run of them can be in flight at once. They are ordered by fences.
+__attribute__((target("clflushopt")))
+inline void clflushoptRange(const uint8_t* start, const uint8_t* end, size_t line)
+{
+	for (const uint8_t* p = start; p < end; p += line)
+		_mm_clflushopt((void*)p);
+}
+
+inline void clflushRange(const uint8_t* start, const uint8_t* end, size_t line)
+{
+	for (const uint8_t* p = start; p < end; p += line)
+		_mm_clflush(p);
+}
+
+#endif
+
+// Reads one byte from every cache line in the buffer.
+// The volatile keeps the compiler from skipping the loads.
+inline void touchLines(const std::vector<uint8_t>& buff, size_t line)
+{
+	const volatile uint8_t* p = buff.data();
+	for (size_t i = 0; i < buff.size(); i += line)
+		(void)p[i];
+}
+
+} // namespace detail
+
+// Gets the cache into a known state before each run.
+class CacheFlusher {
+public:
+	// cacheSize is how much to copy in Copy mode;
+	// the rest of the sizes come from the topology.
+	CacheFlusher(FlushMode m, const CacheTopology& topology, size_t cacheSize) :
+		mode(m),
+		lineSize(topology.lineSize())
+	{
+		switch (mode) {
+			case FlushMode::Copy:
+				buffA.resize(cacheSize);
+				buffB.resize(cacheSize);
+				break;
+
+			case FlushMode::L2: {
+				// Read through a buffer twice the size of L1 and L2.
+				// Replacement policies aren't true LRU, so a buffer just
+				// the size of the caches won't quite evict everything.
+				// The buffer takes up a little room in L3, but most of
+				// whatever was in L3 stays there.
+				size_t size = 0;
+				for (const auto& c : topology.levels) {
+					if (c.holdsData() && c.level <= 2)
+						size += c.size;
+				}
+				buffA.resize(size * 2, 1);
+				break;
+			}
+
+			default:
+				break;
+		}
+
+#if defined(__x86_64__) || defined(__i386__)
+		useClflushopt = detail::haveClflushopt();
+#endif
+	}
+
+	FlushMode getMode() const { return mode; }
+
+	// Gets the given regions out of cache (or doesn't),
+	// according to our mode.
+	void flush(const std::vector<MemoryRegion>& regions)
+	{
+		switch (mode) {
+			case FlushMode::None:
+				break;
+
+			case FlushMode::Copy:
+				// A dumb but effective way to clear the cache is to copy
+				// as much memory as there is cache.
+				memcpy(buffA.data(), buffB.data(), buffA.size());
+				break;
+
+			case FlushMode::Clflush:
+				for (const auto& r : regions)
+					flushRegion(r);
+				fence();
+				break;
+
+			case FlushMode::Stream:
+				for (const auto& r : regions)
+					streamRegion(r);
+				fence();
+				break;
+
+			case FlushMode::L2:
+				detail::touchLines(buffA, lineSize);
+				break;
+		}
+	}
+
+private:
+	FlushMode mode;
+	size_t lineSize;
+	bool useClflushopt = false;
+	std::vector<uint8_t> buffA;
+	std::vector<uint8_t> buffB;
+
+	void flushRegion(const MemoryRegion& r)
+	{
+		// Start at the beginning of the line containing the region's first byte.
+		const uint8_t* start = (const uint8_t*)((uintptr_t)r.start & ~(uintptr_t)(lineSize - 1));
+		const uint8_t* end = (const uint8_t*)r.start + r.size;
+#if defined(__x86_64__) || defined(__i386__)
+		if (useClflushopt)
+			detail::clflushoptRange(start, end, lineSize);
+		else
+			detail::clflushRange(start, end, lineSize);
+#elif defined(__aarch64__)
+		// Clean and invalidate by virtual address to the point of coherency.
+		// Linux lets user space do this.
+		for (const uint8_t* p = start; p < end; p += lineSize)
+			asm volatile("dc civac, %0" : : "r"(p) : "memory");
+#else
+		(void)start;
+		(void)end;
+#endif
+	}
+
+	// Non-temporal stores to a cached line evict it,
+	// so writing the region back over itself with them gets it out of cache.
+	// This is a read and a write per line where clflush is just a flush,
+	// but it's how you'd produce data you don't want to cache.
+	// It does write to the region, though (the same values, but it's
+	// still a store), so a read-only mapping would fault.
+	void streamRegion(const MemoryRegion& r)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		// Only rewrite the lines the region covers completely: the bytes either
+		// side of it aren't ours to store to (another thread could be writing them).
+		// Lines it covers partly, at either end, are clflushed instead.
+		const uintptr_t begin = (uintptr_t)r.start;
+		const uintptr_t end = begin + r.size;
+		const uintptr_t firstLine = (begin + lineSize - 1) & ~(uintptr_t)(lineSize - 1);
+		const uintptr_t lastLine = end & ~(uintptr_t)(lineSize - 1);
+		if (firstLine >= lastLine) {
+			flushRegion(r);
+			return;
+		}
+		if (begin < firstLine)
+			flushRegion({r.start, firstLine - begin});
+		// Whole lines are aligned, so four byte stores line up, whatever the region holds.
+		for (int* p = (int*)firstLine; p < (int*)lastLine; ++p)
+			_mm_stream_si32(p, *p);
+		if (lastLine < end)
+			flushRegion({(const void*)lastLine, end - lastLine});
+#else
+		flushRegion(r);
+#endif
+	}
+
+	static void fence()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		// Wait for the flushes (or non-temporal stores) to finish
+		// so that they don't overlap with the timed work.
+		_mm_mfence();
+#elif defined(__aarch64__)
+		asm volatile("dsb ish" : : : "memory");
+#endif
+	}
+};
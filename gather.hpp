@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "patterns.hpp"
+#include "simd.hpp"
+
+// The indirect patterns, but with 32-bit indices into the data set
+// instead of 64-bit pointers. That halves the memory the indirection costs us,
+// and lets AVX2 and AVX-512 fetch a whole vector of elements
+// with a single gather instruction.
+
+// Sums the squares of data[indices[i]] for i in [0, n)
+using IndexKernel = uint64_t (*)(const int* data, const uint32_t* indices, size_t n);
+
+namespace kernels {
+
+inline uint64_t sumSquaresIndexed(const int* data, const uint32_t* indices, size_t n)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const int64_t d = data[indices[i]];
+		sum += d * d;
+	}
+	return sum;
+}
+
+#ifdef CACHE_DEMO_X86
+
+// Gathers use signed 32-bit indices, which the pattern guarantees
+// are in range (see IndexPattern::setup()).
+__attribute__((target("avx2")))
+inline uint64_t sumSquaresGatherAVX2(const int* data, const uint32_t* indices, size_t n)
+{
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i idx = _mm256_loadu_si256((const __m256i*)(indices + i));
+		accumulateSquaresAVX2(_mm256_i32gather_epi32(data, idx, sizeof(int)), acc0, acc1);
+	}
+
+	uint64_t sum = horizontalSumAVX2(acc0, acc1);
+	for (; i < n; ++i) {
+		const int64_t d = data[indices[i]];
+		sum += d * d;
+	}
+	return sum;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f")))
+inline uint64_t sumSquaresGatherAVX512(const int* data, const uint32_t* indices, size_t n)
+{
+	__m512i acc0 = _mm512_setzero_si512();
+	__m512i acc1 = _mm512_setzero_si512();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m512i idx = _mm512_loadu_si512((const void*)(indices + i));
+		accumulateSquaresAVX512(_mm512_i32gather_epi32(idx, data, sizeof(int)), acc0, acc1);
+	}
+
+	uint64_t sum = horizontalSumAVX512(acc0, acc1);
+	for (; i < n; ++i) {
+		const int64_t d = data[indices[i]];
+		sum += d * d;
+	}
+	return sum;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // CACHE_DEMO_X86
+
+} // namespace kernels
+
+// Walks an array of 32-bit indices into the data set with the given kernel.
+// If Shuffled is set, the indices are shuffled before each run,
+// just like the shuffled-indirect pattern's pointers.
+template <IndexKernel K, bool Shuffled>
+class IndexPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		// The gathers treat indices as signed, so stay below 2^31 elements
+		// (8 GiB of ints). The driver skips us for anything bigger.
+		if (d.size() > (size_t)std::numeric_limits<int32_t>::max())
+			throw std::length_error("Index patterns only support up to 2^31 elements");
+
+		data = &d;
+		indices.resize(d.size());
+		for (size_t i = 0; i < d.size(); ++i)
+			indices[i] = (uint32_t)i;
+	}
+
+	void prepare(std::default_random_engine& re) override
+	{
+		if (Shuffled) {
+			const uint32_t* order = randomPermutation(indices.size(), re);
+			std::copy(order, order + indices.size(), indices.begin());
+		}
+	}
+
+	size_t size() const override { return indices.size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		return K(data->data(), indices.data() + first, last - first);
+	}
+
+	double bytesPerElement() const override { return sizeof(int) + sizeof(uint32_t); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({indices.data(), indices.size() * sizeof(uint32_t)});
+	}
+
+private:
+	const DataSet* data = nullptr;
+	PagedVector<uint32_t> indices;
+};
+
+inline const RegisterPattern<IndexPattern<kernels::sumSquaresIndexed, false>> registerSequentialIndex(
+	"sequential-index", "Sequential-indirect, with 32-bit indices instead of pointers");
+
+inline const RegisterPattern<IndexPattern<kernels::sumSquaresIndexed, true>> registerShuffledIndex(
+	"shuffled-index", "Shuffled-indirect, with 32-bit indices instead of pointers");
+
+#ifdef CACHE_DEMO_X86
+inline const RegisterPattern<IndexPattern<kernels::sumSquaresGatherAVX2, false>> registerSequentialAVX2(
+	"sequential-index-avx2", "Sequential-index, with AVX2 gathers", kernels::haveAVX2);
+
+inline const RegisterPattern<IndexPattern<kernels::sumSquaresGatherAVX2, true>> registerShuffledAVX2(
+	"shuffled-index-avx2", "Shuffled-index, with AVX2 gathers", kernels::haveAVX2);
+
+inline const RegisterPattern<IndexPattern<kernels::sumSquaresGatherAVX512, false>> registerSequentialAVX512(
+	"sequential-index-avx512", "Sequential-index, with AVX-512 gathers", kernels::haveAVX512);
+
+inline const RegisterPattern<IndexPattern<kernels::sumSquaresGatherAVX512, true>> registerShuffledAVX512(
+	"shuffled-index-avx512", "Shuffled-index, with AVX-512 gathers", kernels::haveAVX512);
+#endif
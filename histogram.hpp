@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "stats.hpp"
+
+// Where the time went, run by run.
+//
+// The summary statistics say how long a typical run took, and how far the
+// rest strayed from it, but not in what shape. A pattern that usually takes
+// 2 ms but takes 5 ms whenever THP compaction kicks in, or whenever its
+// SMT sibling is busy, or once the CPU has been running hot for a minute,
+// has a perfectly sensible median and standard deviation that hide the
+// two (or three) runs it's really made of. A histogram shows them.
+//
+// LatencyHistogram is log-bucketed, in the style of HdrHistogram: values
+// below 2^SubBits get a bucket each, and every power of two above that is split
+// into 2^SubBits equal buckets, so each bucket is within 1/2^SubBits (about 3%)
+// of its value, whatever the scale. Recording is a count-leading-zeros and
+// an increment, so it's cheap enough to do between chunks of a timed run
+// (see --histogram-chunk), and the buckets take a fixed 15K, however long we run.
+
+class LatencyHistogram {
+public:
+	static constexpr unsigned int SubBits = 5;
+	static constexpr size_t SubBuckets = (size_t)1 << SubBits;
+	static constexpr size_t Buckets = (64 - SubBits + 1) * SubBuckets;
+
+	// Values are recorded in whatever units the caller has
+	// (nanoseconds, timer ticks...), and unitNs of them make a nanosecond.
+	explicit LatencyHistogram(double unitNs = 1) : unit(unitNs) {}
+
+	void record(uint64_t value)
+	{
+		if (counts.empty())
+			counts.resize(Buckets);
+		++counts[bucketOf(value)];
+		++total;
+		sum += value;
+		lowest = std::min(lowest, value);
+		highest = std::max(highest, value);
+	}
+
+	// Records a time in nanoseconds (rounded to the nearest unit)
+	void recordNs(double ns) { record((uint64_t)(std::max(ns, 0.0) / unit + 0.5)); }
+
+	void clear()
+	{
+		counts.clear();
+		total = 0;
+		sum = 0;
+		lowest = UINT64_MAX;
+		highest = 0;
+	}
+
+	// How many nanoseconds each recorded unit is
+	double unitNs() const { return unit; }
+
+	uint64_t count() const { return total; }
+	bool empty() const { return total == 0; }
+	double sumNs() const { return (double)sum * unit; }
+	double minNs() const { return empty() ? 0 : lowest * unit; }
+	double maxNs() const { return highest * unit; }
+
+	// The pth percentile (0 <= p <= 1), to within a bucket
+	double percentileNs(double p) const
+	{
+		if (empty())
+			return 0;
+		const uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+		uint64_t seen = 0;
+		for (size_t b = 0; b < counts.size(); ++b) {
+			seen += counts[b];
+			if (seen >= rank)
+				return std::min(std::max(midpoint(b), (double)lowest), (double)highest) * unit;
+		}
+		return maxNs();
+	}
+
+	// The buckets, for the charts and exports below:
+	// bucket b holds values in [lowerBound(b), lowerBound(b + 1)).
+	size_t buckets() const { return counts.size(); }
+	uint64_t bucketCount(size_t b) const { return counts[b]; }
+
+	static uint64_t lowerBound(size_t b)
+	{
+		if (b < SubBuckets)
+			return b;
+		const unsigned int shift = (unsigned int)(b / SubBuckets) - 1;
+		return (uint64_t)(SubBuckets + b % SubBuckets) << shift;
+	}
+
+	static size_t bucketOf(uint64_t value)
+	{
+		if (value < SubBuckets)
+			return (size_t)value;
+		const unsigned int magnitude = 63 - (unsigned int)__builtin_clzll(value);
+		const unsigned int shift = magnitude - SubBits;
+		return (size_t)(shift + 1) * SubBuckets + (size_t)((value >> shift) - SubBuckets);
+	}
+
+private:
+	static double midpoint(size_t b)
+	{
+		const uint64_t low = lowerBound(b);
+		const uint64_t width = b < SubBuckets ? 1 : (uint64_t)1 << (b / SubBuckets - 1);
+		return low + (width - 1) / 2.0;
+	}
+
+	double unit;
+	std::vector<uint64_t> counts; // Allocated on the first record(), so empty ones are free to copy
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	uint64_t lowest = UINT64_MAX;
+	uint64_t highest = 0;
+};
+
+// Draws the histogram as rows of #s, like
+//
+//     1.953 us - 2.078 us | ######################################   812 (81.2%)
+//     ...
+//     4.875 us - 5.125 us | #########                              179 (17.9%)
+//
+// Buckets are merged until there are at most maxRows rows, from the fastest
+// value to the slowest; rows in between with nothing in them are still drawn,
+// so that gaps between modes show up as gaps.
+inline void printHistogram(std::ostream& out, const LatencyHistogram& h,
+                           size_t maxRows = 24, size_t width = 40)
+{
+	if (h.empty())
+		return;
+
+	size_t first = 0;
+	while (h.bucketCount(first) == 0)
+		++first;
+	size_t last = h.buckets() - 1;
+	while (h.bucketCount(last) == 0)
+		--last;
+
+	// Merge runs of buckets (aligned, so each row is a constant fraction
+	// of its power of two) until everything fits.
+	size_t perRow = 1;
+	auto rowOf = [&](size_t b) { return b / perRow; };
+	while (perRow < LatencyHistogram::SubBuckets && rowOf(last) - rowOf(first) + 1 > maxRows)
+		perRow *= 2;
+	// Past that, rows are whole powers of two (or more), which always fits.
+	size_t octaves = 1;
+	if (rowOf(last) - rowOf(first) + 1 > maxRows) {
+		perRow = LatencyHistogram::SubBuckets;
+		while (rowOf(last) / octaves - rowOf(first) / octaves + 1 > maxRows)
+			octaves *= 2;
+	}
+
+	struct Row {
+		double low;
+		double high;
+		uint64_t count;
+	};
+	std::vector<Row> rows;
+	for (size_t b = first; b <= last; ++b) {
+		const size_t r = rowOf(b) / octaves;
+		if (rows.empty() || r != rowOf(b - 1) / octaves)
+			rows.push_back({ LatencyHistogram::lowerBound(b) * h.unitNs(), 0, 0 });
+		rows.back().high = b + 1 < h.buckets() ? LatencyHistogram::lowerBound(b + 1) * h.unitNs() : h.maxNs();
+		rows.back().count += h.bucketCount(b);
+	}
+
+	uint64_t most = 0;
+	for (const auto& r : rows)
+		most = std::max(most, r.count);
+
+	for (const auto& r : rows) {
+		const size_t bar = (size_t)((double)r.count / most * width + 0.5);
+		const std::string low = formatTime(r.low);
+		const std::string high = formatTime(r.high);
+		char percent[16];
+		snprintf(percent, sizeof(percent), "%.1f%%", 100.0 * r.count / h.count());
+		out << "  " << std::string(low.size() < 10 ? 10 - low.size() : 0, ' ') << low << " - "
+		    << high << std::string(high.size() < 10 ? 10 - high.size() : 0, ' ') << " | "
+		    << std::string(bar, '#') << std::string(width - bar, ' ') << " "
+		    << r.count << " (" << percent << ")\n";
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "chase.hpp"
+#include "patterns.hpp"
+
+// Hiding latency by doing several lookups at once.
+//
+// A pointer chase only ever has one miss outstanding, since it can't know
+// where to go next until the last load comes back. But if we have G walks
+// that don't depend on each other, we can take a step of each in turn,
+// and have G misses in flight at once instead of one, up to however many
+// the core can track (10 to 20 line fill buffers on recent x86 cores).
+//
+// - shuffled-chase-interleaved splits the shuffled chase into G pieces
+//   and walks them in lockstep. Each piece is a little state machine
+//   (a coroutine, in all but name): on each turn, it uses the element it asked for
+//   on its last turn, works out where it goes next, prefetches that,
+//   and yields to the next piece, so by the time it comes around again,
+//   its element is (hopefully) in cache.
+// - shuffled-group does the same for the shuffled-indirect walk,
+//   whose loads don't depend on each other, but which can still only keep
+//   so many in flight: it prefetches a group of G elements, then sums them.
+//   This is "group prefetching", where shuffled-prefetch's is "software pipelined".
+//
+// G comes from --group, and --group-sweep tries a range of them against
+// the plain shuffled-chase and shuffled-indirect walks.
+
+namespace detail {
+
+// The most lookups we'll interleave (which is far more than any core
+// can keep in flight), so their state fits in an array on the stack.
+constexpr size_t maxGroup = 256;
+
+inline size_t checkGroup(size_t group)
+{
+	if (group == 0 || group > maxGroup)
+		throw std::invalid_argument("The group size must be between 1 and " + std::to_string(maxGroup));
+	return group;
+}
+
+} // namespace detail
+
+class InterleavedChasePattern : public ChasePattern<true> {
+public:
+	explicit InterleavedChasePattern(const PatternParams& params) :
+		group(detail::checkGroup(params.group))
+	{
+	}
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		const int* d = data->data();
+		const uint32_t* n = next.data();
+
+		// Split the range into pieces that (but for the first)
+		// start at checkpoints, so finding where they start is free.
+		const size_t length = last - first;
+		size_t ends[detail::maxGroup];
+		uint32_t at[detail::maxGroup];
+		size_t pieces = 0;
+		size_t start = first;
+		for (size_t g = 0; g < group && start < last; ++g) {
+			size_t end = first + length * (g + 1) / group;
+			end = std::min(last, (end + checkpointInterval - 1) / checkpointInterval * checkpointInterval);
+			if (end <= start)
+				continue;
+			at[pieces] = elementAt(start);
+			ends[pieces] = end - start;
+			++pieces;
+			start = end;
+		}
+
+		for (size_t p = 0; p < pieces; ++p) {
+			__builtin_prefetch(&d[at[p]]);
+			__builtin_prefetch(&n[at[p]]);
+		}
+
+		// Take turns until the shortest piece is done,
+		// then drop it (and any others that are) and keep going with the rest.
+		uint64_t sum = 0;
+		while (pieces > 0) {
+			const size_t steps = *std::min_element(ends, ends + pieces);
+			for (size_t s = 0; s < steps; ++s) {
+				for (size_t p = 0; p < pieces; ++p) {
+					const uint32_t i = at[p];
+					const int64_t v = d[i];
+					sum += v * v;
+					const uint32_t following = n[i];
+					__builtin_prefetch(&d[following]);
+					__builtin_prefetch(&n[following]);
+					at[p] = following;
+				}
+			}
+
+			size_t kept = 0;
+			for (size_t p = 0; p < pieces; ++p) {
+				if (ends[p] == steps)
+					continue;
+				at[kept] = at[p];
+				ends[kept] = ends[p] - steps;
+				++kept;
+			}
+			pieces = kept;
+		}
+		return sum;
+	}
+
+private:
+	size_t group;
+};
+
+class GroupPrefetchPattern : public ShuffledPattern {
+public:
+	explicit GroupPrefetchPattern(const PatternParams& params) :
+		group(detail::checkGroup(params.group))
+	{
+	}
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		int* const* p = pointers.data();
+		uint64_t sum = 0;
+		for (size_t i = first; i < last; i += group) {
+			const size_t end = std::min(last, i + group);
+			for (size_t j = i; j < end; ++j)
+				__builtin_prefetch(p[j]);
+			for (size_t j = i; j < end; ++j) {
+				const int64_t d = *p[j];
+				sum += d * d;
+			}
+		}
+		return sum;
+	}
+
+private:
+	size_t group;
+};
+
+inline const RegisterPattern<InterleavedChasePattern> registerInterleavedChase(
+	"shuffled-chase-interleaved", "Shuffled-chase, split into --group walks taken a step at a time");
+
+inline const RegisterPattern<GroupPrefetchPattern> registerGroupPrefetch(
+	"shuffled-group", "Shuffled-indirect, prefetching --group elements at a time, then summing them");
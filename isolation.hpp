@@ -0,0 +1,323 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "threads.hpp"
+
+// Keeping the timed thread's surroundings still.
+//
+// Run to run, the same pattern can vary by far more than its samples do
+// within a run: the scheduler moves us to another core (with cold caches,
+// and maybe on another socket), something else gets our time slice,
+// or turbo settles on a different clock. So:
+//
+// - --pin-cpu pins the timed thread to one CPU, for the whole run.
+// - --raise-priority makes it SCHED_FIFO if we're allowed to, so that
+//   ordinary processes can't preempt it, or failing that, lowers its
+//   nice value as far as RLIMIT_NICE lets us.
+// - --frequency reports the clock each pattern actually ran at,
+//   from the APERF and MPERF MSRs if we can read them (as root, with the msr
+//   module loaded), or from perf's cycles and ref-cycles counters if not.
+//   If it's well off nominal, or differs between patterns, the times
+//   (in nanoseconds, not cycles) will have that baked in.
+// - --smt-noise runs a thread on the timed CPU's SMT sibling, to see how much
+//   a busy neighbour costs each pattern: alu keeps the core's execution units
+//   busy, and memory streams through a buffer twice the size of L2,
+//   competing for L1, L2, and the line fill buffers.
+
+// The CPUs that share a core with the given one (not including it),
+// or nothing if it has none (or we can't tell).
+inline std::vector<int> smtSiblings(int cpu)
+{
+	std::vector<int> siblings;
+	std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+	std::string list;
+	if (!std::getline(in, list))
+		return siblings;
+
+	// Something like "3,67" or "0-1"
+	size_t at = 0;
+	while (at < list.size()) {
+		int first, last, used;
+		const char* s = list.c_str() + at;
+		if (sscanf(s, "%d-%d%n", &first, &last, &used) != 2) {
+			if (sscanf(s, "%d%n", &first, &used) != 1)
+				break;
+			last = first;
+		}
+		for (int c = first; c <= last; ++c) {
+			if (c != cpu)
+				siblings.push_back(c);
+		}
+		at += used + 1; // Past the comma
+	}
+	return siblings;
+}
+
+// The one CPU the calling thread is pinned to, or -1 if it can run on more than one
+inline int pinnedCPU()
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1) {
+		for (int i = 0; i < CPU_SETSIZE; ++i) {
+			if (CPU_ISSET(i, &set))
+				return i;
+		}
+	}
+#endif
+	return -1;
+}
+
+// Raises the calling thread's scheduling priority as far as we're allowed.
+// Returns what we got ("SCHED_FIFO" or "nice -N"), or the empty string
+// if we couldn't raise it at all, with why not in error.
+// Threads started afterwards inherit it.
+inline std::string raisePriority(std::string& error)
+{
+#ifdef __linux__
+	// The lowest real-time priority is plenty to keep ordinary processes off our CPU;
+	// the kernel still keeps back some of each second for them (see sched_rt_runtime_us).
+	sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = 1;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) == 0)
+		return "SCHED_FIFO";
+	error = std::string("couldn't switch to SCHED_FIFO (") + strerror(errno) + ")";
+
+	for (int nice = -20; nice < 0; ++nice) {
+		if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) == 0)
+			return "nice " + std::to_string(nice);
+	}
+	error += ", or lower our nice value (" + std::string(strerror(errno)) + ")";
+#else
+	error = "raising the priority is only supported on Linux";
+#endif
+	return "";
+}
+
+// Actual and reference (nominal frequency) cycles, and the time they took
+struct ClockCounts {
+	double actual = 0;
+	double reference = 0;
+	double ns = 0;
+
+	bool empty() const { return ns == 0 || actual == 0; }
+	double ghz() const { return actual / ns; }
+	// The nominal (base, or TSC) frequency, if we counted reference cycles
+	double nominalGHz() const { return reference / ns; }
+};
+
+// Reads a core's actual and reference cycle counts, to work out how fast it's clocked.
+class FrequencyMeter {
+public:
+	// Uses the MSRs of the CPU the calling thread is pinned to, if it's
+	// pinned to just one and we can read them, and perf counters on this
+	// thread if not. If neither works, available() is false and error() says why.
+	FrequencyMeter()
+	{
+#ifdef __linux__
+		const int cpu = pinnedCPU();
+		if (cpu >= 0) {
+			msr = open(("/dev/cpu/" + std::to_string(cpu) + "/msr").c_str(), O_RDONLY);
+			uint64_t unused;
+			if (msr >= 0 && pread(msr, &unused, sizeof(unused), aperfMSR) == (ssize_t)sizeof(unused))
+				return;
+			errorMessage = "couldn't read /dev/cpu/" + std::to_string(cpu) + "/msr (" + strerror(errno) + ")";
+			if (msr >= 0)
+				close(msr);
+			msr = -1;
+		}
+		else {
+			errorMessage = "the timed thread isn't pinned to one CPU, so we can't use its MSRs";
+		}
+
+		cycles = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+		if (cycles < 0) {
+			errorMessage += ", or count cycles (" + std::string(strerror(errno)) + ")";
+			return;
+		}
+		referenceCycles = openCounter(PERF_COUNT_HW_REF_CPU_CYCLES);
+#else
+		errorMessage = "measuring the clock is only supported on Linux";
+#endif
+	}
+
+	~FrequencyMeter()
+	{
+#ifdef __linux__
+		for (int fd : { msr, cycles, referenceCycles }) {
+			if (fd >= 0)
+				close(fd);
+		}
+#endif
+	}
+
+	FrequencyMeter(const FrequencyMeter&) = delete;
+	FrequencyMeter& operator=(const FrequencyMeter&) = delete;
+
+	bool available() const { return msr >= 0 || cycles >= 0; }
+	const std::string& error() const { return errorMessage; }
+
+	// "APERF/MPERF" or "perf cycles"
+	const char* source() const { return msr >= 0 ? "APERF/MPERF" : "perf cycles"; }
+
+	// Takes a reading of both counts (reference is 0 if we can't count it).
+	void read(uint64_t& actual, uint64_t& reference) const
+	{
+		actual = reference = 0;
+#ifdef __linux__
+		if (msr >= 0) {
+			// MPERF ticks at the nominal frequency whenever the core is awake,
+			// and APERF at whatever frequency it's actually running.
+			if (pread(msr, &actual, sizeof(actual), aperfMSR) != (ssize_t)sizeof(actual) ||
+			    pread(msr, &reference, sizeof(reference), mperfMSR) != (ssize_t)sizeof(reference))
+				actual = reference = 0;
+			return;
+		}
+		if (cycles >= 0 && ::read(cycles, &actual, sizeof(actual)) != (ssize_t)sizeof(actual))
+			actual = 0;
+		if (referenceCycles >= 0 && ::read(referenceCycles, &reference, sizeof(reference)) != (ssize_t)sizeof(reference))
+			reference = 0;
+#endif
+	}
+
+	// Adds the counts between two readings, over ns nanoseconds, to totals.
+	static void add(ClockCounts& totals, uint64_t actualBefore, uint64_t referenceBefore,
+	                uint64_t actualAfter, uint64_t referenceAfter, double ns)
+	{
+		totals.actual += (double)(actualAfter - actualBefore);
+		totals.reference += (double)(referenceAfter - referenceBefore);
+		totals.ns += ns;
+	}
+
+private:
+	static constexpr uint32_t mperfMSR = 0xe7;
+	static constexpr uint32_t aperfMSR = 0xe8;
+
+	int msr = -1;
+	int cycles = -1;
+	int referenceCycles = -1;
+	std::string errorMessage;
+
+#ifdef __linux__
+	// Opens a user-space hardware counter on this thread,
+	// counting from the moment it's opened.
+	static int openCounter(uint64_t config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+};
+
+// What the SMT noise thread does
+enum class NoiseKind {
+	None,
+	Alu, // Independent chains of integer multiplies and xors
+	Memory, // Streaming reads and writes through a buffer bigger than L2
+};
+
+inline const char* noiseKindName(NoiseKind k)
+{
+	switch (k) {
+		case NoiseKind::Alu: return "alu";
+		case NoiseKind::Memory: return "memory";
+		default: return "none";
+	}
+}
+
+// A thread that makes noise on the given CPU until it's destroyed.
+class NoiseThread {
+public:
+	NoiseThread(NoiseKind kind, int cpu, size_t bufferBytes) :
+		buffer(kind == NoiseKind::Memory ? bufferBytes / sizeof(uint64_t) : 0, 1),
+		started(std::chrono::steady_clock::now())
+	{
+		thread = std::thread([this, kind, cpu] {
+			pinThisThread(cpu);
+			if (kind == NoiseKind::Alu)
+				alu();
+			else
+				memory();
+		});
+	}
+
+	~NoiseThread()
+	{
+		stopping.store(true, std::memory_order_relaxed);
+		thread.join();
+	}
+
+	NoiseThread(const NoiseThread&) = delete;
+	NoiseThread& operator=(const NoiseThread&) = delete;
+
+	// Operations (multiplies, or 8-byte words read and written) per second so far.
+	// Compared between quiet and noisy patterns, it shows how much
+	// the pattern got in the noise's way, as well as the other way around.
+	double opsPerSecond() const
+	{
+		const double seconds =
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		return (double)ops.load(std::memory_order_relaxed) / seconds;
+	}
+
+private:
+	std::vector<uint64_t> buffer;
+	std::chrono::steady_clock::time_point started;
+	std::atomic<bool> stopping{false};
+	std::atomic<uint64_t> ops{0};
+	uint64_t sink = 0;
+	std::thread thread;
+
+	void alu()
+	{
+		uint64_t a = 1, b = 2, c = 3, d = 4;
+		while (!stopping.load(std::memory_order_relaxed)) {
+			for (int i = 0; i < 4096; ++i) {
+				a = a * 0x9e3779b97f4a7c15ull ^ (a >> 29);
+				b = b * 0xbf58476d1ce4e5b9ull ^ (b >> 27);
+				c = c * 0x94d049bb133111ebull ^ (c >> 31);
+				d = d * 0x2545f4914f6cdd1dull ^ (d >> 33);
+			}
+			ops.fetch_add(4 * 4096, std::memory_order_relaxed);
+		}
+		sink = a + b + c + d;
+	}
+
+	void memory()
+	{
+		uint64_t* p = buffer.data();
+		const size_t n = buffer.size();
+		while (!stopping.load(std::memory_order_relaxed)) {
+			for (size_t i = 0; i < n; ++i)
+				p[i] += i;
+			ops.fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+};
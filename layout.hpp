@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "patterns.hpp"
+
+// Array-of-structs vs. struct-of-arrays.
+//
+// Real records have more than one field, but most loops only look at one or
+// two of them. If the records are laid out one after another (AoS),
+// every cache line we pull in for the field we want is mostly other fields
+// we don't. Storing each field in its own array (SoA) means every byte we
+// pull in is one we use; the hybrid (AoSoA) stores small blocks of records
+// field by field, which keeps each field's values together in whole cache
+// lines while keeping a record's fields near each other.
+//
+// Each pattern here walks the same records, one int "value" field of
+// a larger record, copied from the data set before each run.
+// So that the record patterns take up about as much memory as the data set
+// (rather than 32 times as much, with 128-byte records), they hold one record
+// per record-sized chunk of the data set and walk just those.
+// Compare them by time per element, which --sweep prints.
+
+// A record of the given size in bytes, of which we only ever touch value.
+template <size_t Bytes>
+struct Record {
+	static_assert(Bytes % sizeof(int) == 0 && Bytes > sizeof(int), "Records are made of ints");
+	static constexpr size_t fields = Bytes / sizeof(int);
+
+	int value;
+	int otherFields[fields - 1];
+};
+
+namespace detail {
+
+// How many records we make for a data set
+template <size_t Bytes>
+size_t recordCount(const DataSet& data)
+{
+	return std::max<size_t>(1, data.size() * sizeof(int) / Bytes);
+}
+
+// Gives the fields we don't touch something other than zero,
+// so they're just as real to the memory system as the value.
+inline int otherFieldValue(size_t record, size_t field) { return (int)(record * 31 + field); }
+
+} // namespace detail
+
+// Records one after another
+template <size_t Bytes>
+class AoSPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		records.resize(detail::recordCount<Bytes>(d));
+		for (size_t i = 0; i < records.size(); ++i) {
+			for (size_t f = 1; f < Record<Bytes>::fields; ++f)
+				records[i].otherFields[f - 1] = detail::otherFieldValue(i, f);
+		}
+	}
+
+	void prepare(std::default_random_engine&) override
+	{
+		for (size_t i = 0; i < records.size(); ++i)
+			records[i].value = (*data)[i];
+	}
+
+	size_t size() const override { return records.size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		uint64_t sum = 0;
+		for (size_t i = first; i < last; ++i) {
+			const int64_t v = records[i].value;
+			sum += v * v;
+		}
+		return sum;
+	}
+
+	// We pull in a whole line per record (or a whole record, if they're smaller).
+	double bytesPerElement() const override { return (double)std::min<size_t>(Bytes, 64); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({records.data(), records.size() * sizeof(Record<Bytes>)});
+	}
+
+private:
+	const DataSet* data = nullptr;
+	PagedVector<Record<Bytes>> records;
+};
+
+// Each field in its own array
+template <size_t Bytes>
+class SoAPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		const size_t n = detail::recordCount<Bytes>(d);
+		for (size_t f = 0; f < columns.size(); ++f) {
+			columns[f].resize(n);
+			for (size_t i = 0; f > 0 && i < n; ++i)
+				columns[f][i] = detail::otherFieldValue(i, f);
+		}
+	}
+
+	void prepare(std::default_random_engine&) override
+	{
+		std::copy(data->begin(), data->begin() + columns[0].size(), columns[0].begin());
+	}
+
+	size_t size() const override { return columns[0].size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		const int* values = columns[0].data();
+		uint64_t sum = 0;
+		for (size_t i = first; i < last; ++i) {
+			const int64_t v = values[i];
+			sum += v * v;
+		}
+		return sum;
+	}
+
+	double bytesPerElement() const override { return sizeof(int); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		for (const auto& c : columns)
+			regions.push_back({c.data(), c.size() * sizeof(int)});
+	}
+
+private:
+	const DataSet* data = nullptr;
+	std::array<PagedVector<int>, Record<Bytes>::fields> columns;
+};
+
+// Blocks of records, each stored field by field.
+// 16 ints is a cache line, so each field of a block fills exactly one.
+template <size_t Bytes>
+class AoSoAPattern : public AccessPattern {
+public:
+	static constexpr size_t lanes = 16;
+
+	struct Block {
+		int fields[Record<Bytes>::fields][lanes];
+	};
+
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		count = detail::recordCount<Bytes>(d);
+		blocks.resize((count + lanes - 1) / lanes);
+		for (size_t i = 0; i < blocks.size() * lanes; ++i) {
+			for (size_t f = 1; f < Record<Bytes>::fields; ++f)
+				blocks[i / lanes].fields[f][i % lanes] = detail::otherFieldValue(i, f);
+		}
+	}
+
+	void prepare(std::default_random_engine&) override
+	{
+		for (size_t i = 0; i < count; ++i)
+			blocks[i / lanes].fields[0][i % lanes] = (*data)[i];
+	}
+
+	size_t size() const override { return count; }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		uint64_t sum = 0;
+		size_t i = first;
+
+		// Any partial block at the front...
+		for (; i < last && i % lanes != 0; ++i)
+			sum += square(i);
+
+		// ...whole blocks, whose values the compiler can vectorize...
+		for (; i + lanes <= last; i += lanes) {
+			const int* values = blocks[i / lanes].fields[0];
+			for (size_t l = 0; l < lanes; ++l) {
+				const int64_t v = values[l];
+				sum += v * v;
+			}
+		}
+
+		// ...and any partial block at the back.
+		for (; i < last; ++i)
+			sum += square(i);
+		return sum;
+	}
+
+	double bytesPerElement() const override { return sizeof(int); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({blocks.data(), blocks.size() * sizeof(Block)});
+	}
+
+private:
+	const DataSet* data = nullptr;
+	size_t count = 0;
+	PagedVector<Block> blocks;
+
+	uint64_t square(size_t i) const
+	{
+		const int64_t v = blocks[i / lanes].fields[0][i % lanes];
+		return (uint64_t)(v * v);
+	}
+};
+
+inline const RegisterPattern<AoSPattern<16>> registerAoS16(
+	"aos-16", "One int field of 16-byte records, stored one after another");
+inline const RegisterPattern<AoSPattern<64>> registerAoS64(
+	"aos-64", "Same, with 64-byte records");
+inline const RegisterPattern<AoSPattern<128>> registerAoS128(
+	"aos-128", "Same, with 128-byte records");
+
+inline const RegisterPattern<SoAPattern<16>> registerSoA16(
+	"soa-16", "One int field of 16-byte records, each field in its own array");
+inline const RegisterPattern<SoAPattern<64>> registerSoA64(
+	"soa-64", "Same, with 64-byte records");
+inline const RegisterPattern<SoAPattern<128>> registerSoA128(
+	"soa-128", "Same, with 128-byte records");
+
+inline const RegisterPattern<AoSoAPattern<16>> registerAoSoA16(
+	"aosoa-16", "One int field of 16-byte records, in blocks of 16 stored field by field");
+inline const RegisterPattern<AoSoAPattern<64>> registerAoSoA64(
+	"aosoa-64", "Same, with 64-byte records");
+inline const RegisterPattern<AoSoAPattern<128>> registerAoSoA128(
+	"aosoa-128", "Same, with 128-byte records");
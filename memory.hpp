@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Backing the data set and the patterns' arrays with huge pages.
+//
+// With 4K pages, a 120 MiB shuffled walk touches a different page on nearly
+// every access, and the TLB (which caches address translations) can only
+// cover a few megabytes of them. So every cache miss comes with a TLB miss
+// and a page table walk on top. 2M or 1G pages cover the whole data set
+// with a handful of TLB entries, leaving just the cache misses.
+
+enum class PageMode {
+	Small, // Regular (usually 4K) pages, with transparent huge pages turned off
+	Transparent, // Ask for transparent huge pages with madvise()
+	Huge2M, // Explicit 2M pages from the hugetlb pool (see /proc/sys/vm/nr_hugepages)
+	Huge1G, // Explicit 1G pages, which usually have to be reserved at boot
+};
+
+inline const char* pageModeName(PageMode m)
+{
+	switch (m) {
+		case PageMode::Small: return "4k";
+		case PageMode::Transparent: return "thp";
+		case PageMode::Huge2M: return "2m";
+		case PageMode::Huge1G: return "1g";
+	}
+	return "?";
+}
+
+// Throws invalid_argument if the name isn't one of the above
+inline PageMode parsePageMode(const std::string& name)
+{
+	for (PageMode m : { PageMode::Small, PageMode::Transparent, PageMode::Huge2M, PageMode::Huge1G }) {
+		if (name == pageModeName(m))
+			return m;
+	}
+	throw std::invalid_argument("Unknown page mode \"" + name + "\"");
+}
+
+// The kind of pages new allocations get.
+// Set this before allocating; existing allocations keep whatever they got.
+inline PageMode& pageMode()
+{
+	static PageMode mode = PageMode::Small;
+	return mode;
+}
+
+// If we can't get the pages we asked for, we fall back to the next best thing
+// (1G -> 2M -> transparent -> small) and note why here,
+// so the driver can tell the user. Each message appears once.
+inline std::vector<std::string>& pageWarnings()
+{
+	static std::vector<std::string> warnings;
+	return warnings;
+}
+
+namespace detail {
+
+inline void warnAboutPages(const std::string& message)
+{
+	auto& w = pageWarnings();
+	if (std::find(w.begin(), w.end(), message) == w.end())
+		w.push_back(message);
+}
+
+#ifdef __linux__
+
+// How big each of our mappings is, so we can unmap it later.
+// (We can't just round the size we're given back up, since we don't know
+// which kind of pages the allocation ended up with.)
+struct Mappings {
+	std::mutex lock;
+	std::map<void*, size_t> sizes;
+};
+
+inline Mappings& mappings()
+{
+	static Mappings m;
+	return m;
+}
+
+// Older libcs don't define these, but the kernel has understood them since 3.8:
+// the log2 of the page size we want goes in the top bits of the flags.
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+inline size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+inline void* mapAnonymous(size_t bytes, int extraFlags)
+{
+	void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS | extraFlags, -1, 0);
+	return p == MAP_FAILED ? nullptr : p;
+}
+
+// Maps at least the given number of bytes with the given kind of pages
+// (or the best we can manage), storing the mapping's actual size.
+inline void* mapPages(size_t bytes, PageMode mode, size_t& mapped)
+{
+	const size_t twoMeg = 2 * 1024 * 1024;
+	const size_t oneGig = 1024 * 1024 * 1024;
+
+	if (mode == PageMode::Huge1G) {
+		mapped = roundUp(bytes, oneGig);
+		if (void* p = mapAnonymous(mapped, MAP_HUGETLB | MAP_HUGE_1GB))
+			return p;
+		warnAboutPages(std::string("couldn't get 1G huge pages (") + strerror(errno) +
+		               "), falling back to 2M ones");
+		mode = PageMode::Huge2M;
+	}
+
+	if (mode == PageMode::Huge2M) {
+		mapped = roundUp(bytes, twoMeg);
+		void* p = mapAnonymous(mapped, MAP_HUGETLB | MAP_HUGE_2MB);
+		if (p != nullptr)
+			return p;
+		warnAboutPages(std::string("couldn't get 2M huge pages (") + strerror(errno) +
+		               "), falling back to transparent ones");
+		mode = PageMode::Transparent;
+	}
+
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	if (mode == PageMode::Transparent) {
+		// Transparent huge pages have to be 2M-aligned,
+		// so map an extra 2M and trim off whatever's on either side.
+		mapped = roundUp(bytes, twoMeg);
+		uint8_t* raw = (uint8_t*)mapAnonymous(mapped + twoMeg, 0);
+		if (raw == nullptr)
+			return nullptr;
+		uint8_t* aligned = (uint8_t*)roundUp((uintptr_t)raw, twoMeg);
+		if (aligned != raw)
+			munmap(raw, aligned - raw);
+		if (raw + twoMeg != aligned)
+			munmap(aligned + mapped, (raw + twoMeg) - aligned);
+
+		if (madvise(aligned, mapped, MADV_HUGEPAGE) != 0) {
+			warnAboutPages(std::string("couldn't ask for transparent huge pages (") +
+			               strerror(errno) + "), using small ones");
+		}
+		return aligned;
+	}
+
+	mapped = roundUp(bytes, page);
+	void* p = mapAnonymous(mapped, 0);
+	// Make sure a system with transparent huge pages always on
+	// doesn't quietly give us huge pages anyway.
+	if (p != nullptr)
+		madvise(p, mapped, MADV_NOHUGEPAGE);
+	return p;
+}
+
+#endif // __linux__
+
+} // namespace detail
+
+// A standard allocator that gets its memory straight from mmap(),
+// with whatever kind of pages pageMode() says.
+// It's meant for a few big allocations, not lots of little ones:
+// every allocation is at least a page.
+template <typename T>
+struct PageAllocator {
+	using value_type = T;
+
+	PageAllocator() = default;
+
+	template <typename U>
+	PageAllocator(const PageAllocator<U>&) { }
+
+	T* allocate(size_t n)
+	{
+		const size_t bytes = std::max<size_t>(n * sizeof(T), 1);
+#ifdef __linux__
+		size_t mapped;
+		void* p = detail::mapPages(bytes, pageMode(), mapped);
+		if (p == nullptr)
+			throw std::bad_alloc();
+
+		auto& m = detail::mappings();
+		std::lock_guard<std::mutex> guard(m.lock);
+		m.sizes[p] = mapped;
+		return (T*)p;
+#else
+		return (T*)::operator new(bytes);
+#endif
+	}
+
+	void deallocate(T* p, size_t)
+	{
+#ifdef __linux__
+		auto& m = detail::mappings();
+		std::lock_guard<std::mutex> guard(m.lock);
+		auto it = m.sizes.find(p);
+		if (it != m.sizes.end()) {
+			munmap(p, it->second);
+			m.sizes.erase(it);
+		}
+#else
+		::operator delete(p);
+#endif
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const PageAllocator<T>&, const PageAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const PageAllocator<T>&, const PageAllocator<U>&) { return false; }
+
+// How many bytes PageAllocator really mapped for its allocation at p, given
+// that it was asked for n: a whole number of whichever pages it ended up with,
+// which with huge pages can be a lot more than n.
+inline size_t mappedBytes(const void* p, size_t n)
+{
+#ifdef __linux__
+	auto& m = detail::mappings();
+	std::lock_guard<std::mutex> guard(m.lock);
+	auto it = m.sizes.find(const_cast<void*>(p));
+	if (it != m.sizes.end())
+		return it->second;
+#else
+	(void)p;
+#endif
+	return n;
+}
+
+// A vector whose memory comes from PageAllocator
+template <typename T>
+using PagedVector = std::vector<T, PageAllocator<T>>;
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/mempolicy.h> // For MPOL_*
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "flush.hpp" // For MemoryRegion
+#include "topology.hpp"
+
+// Placing memory on particular NUMA nodes.
+//
+// On a multi-socket machine, each socket has its own memory,
+// and reaching across to another socket's memory costs extra latency
+// and shares a (comparatively narrow) link between them.
+// By default, Linux puts each page on whichever node first touches it,
+// which for us means "wherever the main thread was running."
+//
+// We talk to the kernel with mbind() directly instead of going through libnuma
+// so that there's nothing extra to install or link against.
+
+// A NUMA node and the CPUs that belong to it
+struct NumaNode {
+	int id;
+	std::vector<int> cpus;
+};
+
+// Returns the machine's NUMA nodes (at least one, even if the kernel
+// doesn't tell us about any, in which case it has every CPU).
+inline std::vector<NumaNode> numaNodes()
+{
+	std::vector<NumaNode> nodes;
+#ifdef __linux__
+	if (DIR* dir = opendir("/sys/devices/system/node")) {
+		while (dirent* e = readdir(dir)) {
+			int id;
+			char extra;
+			if (sscanf(e->d_name, "node%d%c", &id, &extra) != 1)
+				continue;
+			std::string cpus;
+			detail::readFile(std::string("/sys/devices/system/node/") + e->d_name + "/cpulist", cpus);
+			nodes.push_back({id, detail::parseCPUList(cpus)});
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(nodes.begin(), nodes.end(),
+		[](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+
+	if (nodes.empty()) {
+		NumaNode all = { 0, {} };
+		for (unsigned int i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); ++i)
+			all.cpus.push_back((int)i);
+		nodes.push_back(all);
+	}
+	return nodes;
+}
+
+// Where to put a chunk of memory
+struct NumaPlacement {
+	enum Kind {
+		FirstTouch, // Leave it wherever the kernel put it
+		Bind, // Move it all to one node
+		Interleave, // Spread it page by page over every node
+	};
+
+	Kind kind = FirstTouch;
+	int node = 0; // For Bind
+};
+
+// Moves the pages of the given region according to the placement.
+// Since mbind() works on whole pages, any partial pages at either end are left alone.
+// Returns an error message on failure, or an empty string on success.
+inline std::string placeMemory(const MemoryRegion& region, const NumaPlacement& placement)
+{
+	if (placement.kind == NumaPlacement::FirstTouch)
+		return "";
+
+#ifdef __linux__
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	const uintptr_t start = ((uintptr_t)region.start + page - 1) & ~(page - 1);
+	const uintptr_t end = ((uintptr_t)region.start + region.size) & ~(page - 1);
+	if (end <= start)
+		return "";
+
+	// Nodes are a bitmask, and there's no way we'll see more than 64 of them.
+	unsigned long mask = 0;
+	int mode;
+	if (placement.kind == NumaPlacement::Bind) {
+		if (placement.node < 0 || placement.node >= 64)
+			return "Node " + std::to_string(placement.node) + " is out of range";
+		mode = MPOL_BIND;
+		mask = 1ul << placement.node;
+	}
+	else {
+		mode = MPOL_INTERLEAVE;
+		for (const auto& n : numaNodes()) {
+			if (n.id < 64)
+				mask |= 1ul << n.id;
+		}
+	}
+
+	// MPOL_MF_MOVE migrates pages that have already been touched,
+	// which (since vectors zero their contents) is all of them.
+	if (syscall(SYS_mbind, start, end - start, mode, &mask, sizeof(mask) * 8,
+	            MPOL_MF_MOVE | MPOL_MF_STRICT) != 0)
+		return std::string("mbind failed: ") + strerror(errno);
+	return "";
+#else
+	(void)region;
+	return "NUMA placement is only supported on Linux";
+#endif
+}
+
+// Merges regions that share a page (along with the bytes between them),
+// since placeMemory() only moves the pages a region covers completely,
+// and would leave a region smaller than a page where it is.
+inline void mergeByPage(std::vector<MemoryRegion>& regions)
+{
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	std::sort(regions.begin(), regions.end(),
+		[](const MemoryRegion& a, const MemoryRegion& b) { return a.start < b.start; });
+
+	size_t merged = 0;
+	for (const auto& r : regions) {
+		if (merged > 0) {
+			MemoryRegion& last = regions[merged - 1];
+			const uintptr_t lastEnd = (uintptr_t)last.start + last.size;
+			if ((uintptr_t)r.start < ((lastEnd + page - 1) & ~(page - 1))) {
+				last.size = std::max(lastEnd, (uintptr_t)r.start + r.size) - (uintptr_t)last.start;
+				continue;
+			}
+		}
+		regions[merged++] = r;
+	}
+	regions.resize(merged);
+}
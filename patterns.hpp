@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "flush.hpp"
+#include "memory.hpp"
+#include "permutations.hpp"
+
+// The data set every pattern walks over.
+// Its memory (and that of the patterns' own arrays) comes from PageAllocator
+// so that we can choose what kind of pages back it.
+// It also remembers the key it was last populated from (see rng.hpp),
+// so that patterns which need more random numbers to go with the data
+// (like the search patterns' lookups) can derive the same ones from it.
+class DataSet : public PagedVector<int> {
+public:
+	using PagedVector<int>::PagedVector;
+
+	uint64_t key = 0;
+};
+
+// An access pattern is one way of walking over the data set.
+// Every pattern in a run is handed the same data, repopulated before each
+// iteration, so the only thing that differs between them is how memory
+// is laid out and the order in which it gets touched.
+class AccessPattern {
+public:
+	virtual ~AccessPattern() = default;
+
+	// Called once the data set has been allocated so that the pattern can
+	// build whatever it needs on top of it (pointer arrays and such).
+	// The data set outlives the pattern.
+	// Patterns that can't handle a data set that big throw length_error,
+	// and the driver skips them (for that data set) and times the rest.
+	virtual void setup(DataSet& data) = 0;
+
+	// Called before every run, after the data set has been repopulated
+	// but before the cache is cleared. This is not timed.
+	virtual void prepare(std::default_random_engine&) { }
+
+	// The number of elements doWork() walks
+	virtual size_t size() const = 0;
+
+	// Squares elements [first, last) of the walk and returns their sum.
+	// Multithreaded runs split the walk up between threads with this
+	// (see threads.hpp), so it must be safe to call concurrently.
+	virtual uint64_t sumRange(size_t first, size_t last) const = 0;
+
+	// The work we are actually timing:
+	// the average square of every element in the walk.
+	virtual int doWork() const { return (int)(sumRange(0, size()) / size()); }
+
+	// How many bytes doWork() reads (or writes) per element of the data set,
+	// including any bookkeeping like pointers.
+	// Used to work out how much bandwidth the pattern gets.
+	virtual double bytesPerElement() const { return sizeof(int); }
+
+	// Adds any memory doWork() reads besides the data set itself
+	// (pointer arrays and such), so it can be flushed along with the data.
+	// This can cover bytes in between that aren't the pattern's (like malloc()'s
+	// headers), which clflush doesn't mind, so long as they're readable.
+	virtual void auxiliaryMemory(std::vector<MemoryRegion>&) const { }
+
+	// The same memory, but only the bytes the pattern owns,
+	// for --flush=stream, which writes them back over themselves.
+	// Only patterns whose auxiliaryMemory() covers anything else need to override this.
+	virtual void ownedMemory(std::vector<MemoryRegion>& regions) const { auxiliaryMemory(regions); }
+
+	// Called right after the cache is flushed, before every run, to evict
+	// anything else the pattern reads that flushing can't reach
+	// (like the page cache; see file.hpp). This is not timed.
+	virtual void evict() { }
+};
+
+// Knobs for the patterns that have them, set from the command line.
+// Patterns that want these take them in their constructor.
+struct PatternParams {
+	// How many elements ahead the prefetching patterns prefetch (see prefetch.hpp)
+	size_t prefetchDistance = 16;
+	// The prefetches' temporal locality hint, from 0 (none) to 3 (keep in all levels)
+	int prefetchLocality = 3;
+	// How many elements the strided pattern steps over at a time (see typed.hpp)
+	size_t stride = 16;
+	// The largest tile the tiled patterns partition into, in bytes (see tiled.hpp).
+	// The driver sets it to half of L2 unless told otherwise.
+	size_t tileSize = 128 * 1024;
+	// How many lookups the interleaved patterns have going at once (see interleave.hpp)
+	size_t group = 8;
+	// The most threads that will call sumRange() at once, for patterns that give
+	// each one something of its own up front (indexed by teamMember(); see threads.hpp)
+	size_t threads = 1;
+};
+
+// An entry in the pattern registry
+struct PatternInfo {
+	std::string name;
+	std::string description;
+	std::function<std::unique_ptr<AccessPattern>(const PatternParams&)> create;
+
+	// Whether the pattern can run on this machine
+	// (e.g., whether the CPU has the instructions it needs).
+	// Null means it always can.
+	bool (*supported)();
+
+	bool isSupported() const { return supported == nullptr || supported(); }
+};
+
+// All known access patterns, in the order they were registered.
+// Patterns add themselves with a RegisterPattern (see below),
+// so adding a new one is just a matter of defining it and registering it.
+inline std::vector<PatternInfo>& patternRegistry()
+{
+	static std::vector<PatternInfo> registry;
+	return registry;
+}
+
+// Looks up a pattern by name, returning null if there isn't one.
+inline const PatternInfo* findPattern(const std::string& name)
+{
+	for (const auto& p : patternRegistry()) {
+		if (p.name == name)
+			return &p;
+	}
+	return nullptr;
+}
+
+// Declare an (inline) instance of one of these to register a pattern:
+//
+//     inline const RegisterPattern<MyPattern> registerMine("mine", "Does my thing");
+//
+// Patterns that can't run everywhere can also pass a function that
+// says whether they can run here.
+template <typename P>
+struct RegisterPattern {
+	RegisterPattern(const char* name, const char* description, bool (*supported)() = nullptr)
+	{
+		patternRegistry().push_back({name, description, create, supported});
+	}
+
+	static std::unique_ptr<AccessPattern> create(const PatternParams& params)
+	{
+		if constexpr (std::is_constructible<P, const PatternParams&>::value)
+			return std::unique_ptr<AccessPattern>(new P(params));
+		else {
+			(void)params;
+			return std::unique_ptr<AccessPattern>(new P);
+		}
+	}
+};
+
+// The built-in patterns:
+
+// Walks the data set front to back (what base.cpp used to do).
+class ContiguousPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override { data = &d; }
+
+	size_t size() const override { return data->size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		uint64_t sum = 0;
+
+		// Square each value, widening first so that big ones don't overflow
+		for (size_t i = first; i < last; ++i) {
+			const int64_t d = (*data)[i];
+			sum += d * d;
+		}
+
+		return sum;
+	}
+
+private:
+	const DataSet* data = nullptr;
+};
+
+// Walks an array of pointers to each element of the data set.
+// The pointers are in the same order as the data,
+// so we pay for the extra indirection (and the extra memory the pointers take up),
+// but the hardware prefetcher can still see what we're doing.
+// (This is what indirection.cpp used to do.)
+class IndirectPattern : public AccessPattern {
+public:
+	void setup(DataSet& data) override
+	{
+		base = data.data();
+		pointers.resize(data.size());
+		for (size_t i = 0; i < data.size(); ++i)
+			pointers[i] = &data[i];
+	}
+
+	size_t size() const override { return pointers.size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		uint64_t sum = 0;
+
+		// Square each value
+		for (size_t i = first; i < last; ++i) {
+			const int64_t d = *pointers[i];
+			sum += d * d;
+		}
+
+		return sum;
+	}
+
+	double bytesPerElement() const override { return sizeof(int) + sizeof(int*); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({pointers.data(), pointers.size() * sizeof(int*)});
+	}
+
+protected:
+	int* base = nullptr; // The start of the data set
+	PagedVector<int*> pointers;
+};
+
+// The same as above, but the pointers are shuffled before each run,
+// so every access is a jump to somewhere unpredictable.
+// (This is what random.cpp used to do.)
+class ShuffledPattern : public IndirectPattern {
+public:
+	void prepare(std::default_random_engine& re) override
+	{
+		// Permutations are of 32-bit indices (see permutations.hpp),
+		// so shuffle absurdly big data sets in place instead.
+		if (pointers.size() > std::numeric_limits<uint32_t>::max()) {
+			shuffle(begin(pointers), end(pointers), re);
+			return;
+		}
+
+		const uint32_t* order = randomPermutation(pointers.size(), re);
+		for (size_t i = 0; i < pointers.size(); ++i)
+			pointers[i] = base + order[i];
+	}
+};
+
+inline const RegisterPattern<ContiguousPattern> registerContiguous(
+	"contiguous", "Sum squares of the data set, front to back");
+
+inline const RegisterPattern<IndirectPattern> registerIndirect(
+	"sequential-indirect", "Same, but through an in-order array of pointers");
+
+inline const RegisterPattern<ShuffledPattern> registerShuffled(
+	"shuffled-indirect", "Same, but through a shuffled array of pointers");
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters, via Linux's perf_event_open().
+//
+// The wall clock tells us how long a run took, but not why.
+// These tell us how many cycles and instructions it took,
+// and how many loads missed in L1, in the last level cache, and in the TLB.
+// Divide those by the number of elements and you can see exactly which
+// level of the memory hierarchy each pattern is paying for.
+//
+// Only user-space events on the calling thread are counted,
+// which works without any special privileges on most systems
+// (perf_event_paranoid <= 2). With --threads, that means we only see
+// the timing thread's share of the work.
+
+// The counters we try to open, in the order they're reported
+struct PerfEventInfo {
+	const char* name;
+	uint32_t type;
+	uint64_t config;
+};
+
+#ifdef __linux__
+namespace detail {
+
+constexpr uint64_t cacheEvent(uint64_t cache, uint64_t op, uint64_t result)
+{
+	return cache | (op << 8) | (result << 16);
+}
+
+} // namespace detail
+#endif
+
+inline const std::vector<PerfEventInfo>& perfEvents()
+{
+#ifdef __linux__
+	static const std::vector<PerfEventInfo> events = {
+		{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ "L1d misses", PERF_TYPE_HW_CACHE, detail::cacheEvent(PERF_COUNT_HW_CACHE_L1D,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+		{ "LLC misses", PERF_TYPE_HW_CACHE, detail::cacheEvent(PERF_COUNT_HW_CACHE_LL,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+		{ "dTLB misses", PERF_TYPE_HW_CACHE, detail::cacheEvent(PERF_COUNT_HW_CACHE_DTLB,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	};
+#else
+	static const std::vector<PerfEventInfo> events;
+#endif
+	return events;
+}
+
+// A group of counters that are started and stopped together.
+class PerfCounters {
+public:
+	// Opens whichever of perfEvents() this machine supports.
+	// If none of them open, available() is false and error() says why.
+	PerfCounters()
+	{
+#ifdef __linux__
+		const auto& events = perfEvents();
+		for (size_t i = 0; i < events.size(); ++i) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[i].type;
+			attr.config = events[i].config;
+			attr.disabled = leader < 0 ? 1 : 0; // The group starts and stops with its leader
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+			                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+			if (fd < 0) {
+				if (errorMessage.empty()) {
+					errorMessage = std::string("couldn't open the ") + events[i].name +
+					               " counter (" + strerror(errno) + ")";
+					if (errno == EACCES || errno == EPERM)
+						errorMessage += "; see /proc/sys/kernel/perf_event_paranoid";
+					else if (errno == ENOENT || errno == EOPNOTSUPP)
+						errorMessage += "; this CPU (or VM) doesn't seem to have it";
+				}
+				continue;
+			}
+			if (leader < 0)
+				leader = fd;
+			fds.push_back(fd);
+			opened.push_back(i);
+		}
+#endif
+		buffer.resize(3 + opened.size());
+	}
+
+	~PerfCounters()
+	{
+#ifdef __linux__
+		for (int fd : fds)
+			close(fd);
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool available() const { return !opened.empty(); }
+
+	// Why the first counter that didn't open didn't
+	const std::string& error() const { return errorMessage; }
+
+	// Indexes into perfEvents() of the counters we have,
+	// in the order addTo() adds them.
+	const std::vector<size_t>& events() const { return opened; }
+
+	void start()
+	{
+#ifdef __linux__
+		if (leader >= 0) {
+			ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+#endif
+	}
+
+	void stop()
+	{
+#ifdef __linux__
+		if (leader >= 0)
+			ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	// Adds the counts since the last start() to totals (one per events()).
+	// If the kernel had to multiplex the counters (because there are more
+	// of them than the CPU has), the counts are scaled up to make up for it.
+	void addTo(std::vector<double>& totals)
+	{
+		totals.resize(opened.size());
+#ifdef __linux__
+		if (leader < 0)
+			return;
+		// The layout is { nr, time_enabled, time_running, values[nr] }
+		const ssize_t expected = (ssize_t)(buffer.size() * sizeof(uint64_t));
+		if (::read(leader, buffer.data(), expected) != expected)
+			return;
+		const double enabled = (double)buffer[1];
+		const double running = (double)buffer[2];
+		const double scale = running > 0 ? enabled / running : 0;
+		for (size_t i = 0; i < opened.size(); ++i)
+			totals[i] += buffer[3 + i] * scale;
+#endif
+	}
+
+private:
+	int leader = -1;
+	std::vector<int> fds;
+	std::vector<size_t> opened;
+	std::vector<uint64_t> buffer;
+	std::string errorMessage;
+};
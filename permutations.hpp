@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "rng.hpp"
+
+// The shuffles the patterns walk, optionally cached on disk.
+//
+// Shuffling a big array is all random accesses, so for big data sets
+// it can take longer than everything else put together.
+// With --perm-cache, each shuffle is one of a fixed set of permutationCacheKeys
+// for its size and kind (picked at random from the engine, so the order they
+// come in still depends on the seed), and we save each one the first time we
+// make it and just map the file after that, in this run and later ones.
+// That bounds the cache at permutationCacheKeys files per size and kind,
+// each 4 bytes per element: 4G for a 2^28-element walk, say.
+// (Without the cache, every shuffle gets a key of its own.)
+//
+// A file is a 64-byte header followed by the permutation as raw uint32s,
+// so it can be mmap()ed and used as it is, with nothing to parse.
+// Patterns still copy it into their own arrays (or build pointers from it),
+// so those get the pages and NUMA nodes we asked for,
+// but that's one sequential pass instead of a shuffle.
+//
+// The data set isn't cached: it's generated from a key (see rng.hpp) faster
+// than it could be read back in.
+
+// The directory to cache permutations in, or empty to not cache them.
+inline std::string& permutationCacheDir()
+{
+	static std::string dir;
+	return dir;
+}
+
+// Problems we had reading or writing the cache, for the driver to pass on.
+// We carry on without it; each message appears once.
+inline std::vector<std::string>& permutationWarnings()
+{
+	static std::vector<std::string> warnings;
+	return warnings;
+}
+
+namespace detail {
+
+// How many different shuffles of each size and kind --perm-cache keeps
+constexpr uint64_t permutationCacheKeys = 4;
+
+struct PermutationHeader {
+	char magic[8]; // "CDPERM1" and a NUL
+	uint64_t count;
+	uint64_t key;
+	uint32_t cyclic;
+	uint32_t reserved;
+	uint8_t padding[32];
+};
+
+static_assert(sizeof(PermutationHeader) == 64, "Permutations start a cache line into their files");
+
+constexpr char permutationMagic[8] = "CDPERM1";
+
+inline void warnAboutPermutations(const std::string& message)
+{
+	auto& w = permutationWarnings();
+	if (std::find(w.begin(), w.end(), message) == w.end())
+		w.push_back(message);
+}
+
+inline std::string permutationPath(size_t n, uint64_t key, bool cyclic)
+{
+	char name[80];
+	snprintf(name, sizeof(name), "/perm-%zu-%016llx%s.bin", n, (unsigned long long)key,
+	         cyclic ? "-cycle" : "");
+	return permutationCacheDir() + name;
+}
+
+#ifdef __linux__
+
+// A read-only mapping of a permutation file
+class MappedPermutation {
+public:
+	MappedPermutation() = default;
+	MappedPermutation(const MappedPermutation&) = delete;
+	MappedPermutation& operator=(const MappedPermutation&) = delete;
+
+	~MappedPermutation() { unmap(); }
+
+	// Maps the file, returning false if it's missing or isn't what we expect.
+	bool map(const std::string& path, size_t n, uint64_t key, bool cyclic)
+	{
+		unmap();
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		const size_t expected = sizeof(PermutationHeader) + n * sizeof(uint32_t);
+		struct stat st;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size == expected) {
+			void* p = mmap(nullptr, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				start = p;
+				size = expected;
+			}
+		}
+		close(fd);
+		if (start == nullptr)
+			return false;
+
+		const auto* header = (const PermutationHeader*)start;
+		if (memcmp(header->magic, permutationMagic, sizeof(header->magic)) != 0 ||
+		    header->count != n || header->key != key || header->cyclic != (cyclic ? 1u : 0u)) {
+			warnAboutPermutations(path + " isn't the permutation its name says it is; ignoring it");
+			unmap();
+			return false;
+		}
+		return true;
+	}
+
+	const uint32_t* data() const
+	{
+		return (const uint32_t*)((const uint8_t*)start + sizeof(PermutationHeader));
+	}
+
+private:
+	void* start = nullptr;
+	size_t size = 0;
+
+	void unmap()
+	{
+		if (start != nullptr)
+			munmap(start, size);
+		start = nullptr;
+		size = 0;
+	}
+};
+
+// Writes to a temporary file, then renames it into place,
+// so that a run that dies halfway (or a concurrent one) never sees half a file.
+inline void savePermutation(const std::string& path, const uint32_t* perm,
+                            size_t n, uint64_t key, bool cyclic)
+{
+	mkdir(permutationCacheDir().c_str(), 0777); // Fine if it's already there
+
+	PermutationHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, permutationMagic, sizeof(header.magic));
+	header.count = n;
+	header.key = key;
+	header.cyclic = cyclic ? 1 : 0;
+
+	const std::string temporary = path + ".tmp" + std::to_string(getpid());
+	FILE* f = fopen(temporary.c_str(), "wb");
+	bool ok = f != nullptr &&
+	          fwrite(&header, sizeof(header), 1, f) == 1 &&
+	          fwrite(perm, sizeof(uint32_t), n, f) == n;
+	if (f != nullptr && fclose(f) != 0)
+		ok = false;
+	if (ok && rename(temporary.c_str(), path.c_str()) != 0)
+		ok = false;
+	if (!ok) {
+		warnAboutPermutations("couldn't write to the permutation cache in " +
+		                      permutationCacheDir() + " (" + strerror(errno) + ")");
+		remove(temporary.c_str());
+	}
+}
+
+#endif // __linux__
+
+} // namespace detail
+
+// Returns a random permutation of [0, n) (a single cycle, if cyclic is set;
+// see generatePermutation() in rng.hpp), using a key drawn from the engine.
+// With a cache, the key is one of the cache's few (see above), and the
+// permutation is loaded from the cache if it's there, and saved to it if it isn't.
+// The result is valid until the next call.
+inline const uint32_t* randomPermutation(size_t n, std::default_random_engine& re, bool cyclic = false)
+{
+	if (n > std::numeric_limits<uint32_t>::max())
+		throw std::length_error("Permutations only go up to 2^32 elements");
+
+	const uint64_t key = drawKey(re);
+	static std::vector<uint32_t> generated;
+
+#ifdef __linux__
+	static detail::MappedPermutation mapped;
+	if (!permutationCacheDir().empty()) {
+		const uint64_t cachedKey = SplitMix64(key % detail::permutationCacheKeys).next();
+		const std::string path = detail::permutationPath(n, cachedKey, cyclic);
+		if (mapped.map(path, n, cachedKey, cyclic))
+			return mapped.data();
+
+		generated.resize(n);
+		generatePermutation(generated.data(), n, cachedKey, cyclic);
+		detail::savePermutation(path, generated.data(), n, cachedKey, cyclic);
+		return generated.data();
+	}
+#endif
+
+	generated.resize(n);
+	generatePermutation(generated.data(), n, key, cyclic);
+	return generated.data();
+}
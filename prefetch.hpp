@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "patterns.hpp"
+
+// The shuffled pointer walk, but with software prefetching.
+// The hardware prefetcher can't guess where a shuffled walk goes next,
+// but we can: the whole pointer array is sitting right there.
+// So while we square element i, we ask for element i + D,
+// and hopefully it has arrived by the time we get to it.
+//
+// Too small a distance and the prefetch doesn't beat us there;
+// too large and we evict it again (or clog up the line fill buffers)
+// before it's used. --prefetch-sweep finds the sweet spot.
+
+namespace kernels {
+
+// __builtin_prefetch needs its locality hint to be a constant,
+// so we stamp out one of these for each.
+template <int Locality>
+uint64_t sumSquaresPrefetched(int* const* pointers, size_t n, size_t distance)
+{
+	uint64_t sum = 0;
+	size_t i = 0;
+
+	if (distance > 0 && n > distance) {
+		for (; i < n - distance; ++i) {
+			__builtin_prefetch(pointers[i + distance], 0, Locality);
+			const int64_t d = *pointers[i];
+			sum += d * d;
+		}
+	}
+
+	// Nothing left to prefetch
+	for (; i < n; ++i) {
+		const int64_t d = *pointers[i];
+		sum += d * d;
+	}
+
+	return sum;
+}
+
+} // namespace kernels
+
+class PrefetchPattern : public ShuffledPattern {
+public:
+	explicit PrefetchPattern(const PatternParams& params) :
+		distance(params.prefetchDistance),
+		locality(params.prefetchLocality)
+	{
+		if (locality < 0 || locality > 3)
+			throw std::invalid_argument("Prefetch locality must be between 0 and 3");
+	}
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		int* const* p = pointers.data() + first;
+		const size_t n = last - first;
+		switch (locality) {
+			case 0: return kernels::sumSquaresPrefetched<0>(p, n, distance);
+			case 1: return kernels::sumSquaresPrefetched<1>(p, n, distance);
+			case 2: return kernels::sumSquaresPrefetched<2>(p, n, distance);
+			default: return kernels::sumSquaresPrefetched<3>(p, n, distance);
+		}
+	}
+
+private:
+	size_t distance;
+	int locality;
+};
+
+inline const RegisterPattern<PrefetchPattern> registerPrefetch(
+	"shuffled-prefetch", "Shuffled-indirect, prefetching --prefetch-distance elements ahead");
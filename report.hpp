@@ -0,0 +1,518 @@
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/utsname.h>
+#include <unistd.h>
+#endif
+
+#include "histogram.hpp"
+#include "stats.hpp"
+#include "topology.hpp"
+
+// Machine-readable results, and comparing them against a baseline.
+//
+// --output writes every result (along with what machine it came from)
+// as JSON or CSV, or as OpenMetrics text (with each result's histograms
+// of run and chunk times) for Prometheus to scrape or a pushgateway to take.
+// --baseline reads a JSON or CSV file back in (not OpenMetrics, which
+// readBaseline() doesn't parse), compares each pattern's median against it,
+// and fails the run if any of them got slower by more than --threshold
+// (or if none of them are in the baseline to compare), so results can gate kernel and firmware changes in a script.
+
+// Pass your compiler flags in with -DCACHE_DEMO_FLAGS="\"...\"" to record them.
+// Otherwise we record what we can tell from the predefined macros.
+#ifndef CACHE_DEMO_FLAGS
+#define CACHE_DEMO_FLAGS ""
+#endif
+
+// Where the results came from
+struct HostInfo {
+	std::string hostname;
+	std::string cpu;
+	std::string kernel;
+	std::string compiler;
+	std::string flags;
+	std::string caches; // Something like "L1d 48K, L2 2M, L3 105M, 64 byte lines"
+	std::string timestamp; // ISO 8601, UTC
+};
+
+// One pattern's results over one data set
+struct ResultRow {
+	std::string pattern;
+	size_t dataBytes = 0; // The size of the data set
+	size_t elements = 0; // How many elements the pattern walked over it
+	size_t threads = 1;
+	unsigned int batch = 1; // Calls per timed run
+	double bytesPerElement = 0;
+	Summary summary;
+	// Hardware counters per element, by name, if we counted any
+	std::vector<std::pair<std::string, double>> counts;
+	// Every run's time per call, and with --histogram-chunk,
+	// the time each chunk of chunkElements elements took
+	LatencyHistogram callTimes;
+	LatencyHistogram chunkTimes;
+	size_t chunkElements = 0;
+
+	double nsPerElement() const { return summary.median / elements; }
+	// Bytes per nanosecond is (decimal) gigabytes per second.
+	double gbPerSecond() const { return bytesPerElement * elements / summary.median; }
+};
+
+namespace detail {
+
+inline std::string trim(const std::string& s)
+{
+	const size_t first = s.find_first_not_of(" \t\n");
+	if (first == std::string::npos)
+		return "";
+	return s.substr(first, s.find_last_not_of(" \t\n") - first + 1);
+}
+
+inline std::string cpuModel()
+{
+	std::ifstream in("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(in, line)) {
+		// x86 says "model name", and some older ARM kernels "Processor"
+		if (line.compare(0, 10, "model name") == 0 || line.compare(0, 9, "Processor") == 0) {
+			const size_t colon = line.find(':');
+			if (colon != std::string::npos)
+				return trim(line.substr(colon + 1));
+		}
+	}
+	return "unknown";
+}
+
+inline std::string compilerFlags()
+{
+	std::string flags = CACHE_DEMO_FLAGS;
+	if (!flags.empty())
+		return flags;
+	// The best we can do: which optimization and instruction set macros are on
+#ifdef __OPTIMIZE__
+	flags += "optimized";
+#else
+	flags += "unoptimized";
+#endif
+#ifdef __AVX512F__
+	flags += ", AVX-512 baseline";
+#elif defined(__AVX2__)
+	flags += ", AVX2 baseline";
+#endif
+#ifdef _GLIBCXX_ASSERTIONS
+	flags += ", libstdc++ assertions";
+#endif
+	return flags;
+}
+
+inline void writeJSONString(std::ostream& out, const std::string& s)
+{
+	out << '"';
+	for (char c : s) {
+		switch (c) {
+			case '"': out << "\\\""; break;
+			case '\\': out << "\\\\"; break;
+			case '\n': out << "\\n"; break;
+			case '\t': out << "\\t"; break;
+			default:
+				if ((unsigned char)c < 0x20) {
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)c);
+					out << escaped;
+				}
+				else {
+					out << c;
+				}
+		}
+	}
+	out << '"';
+}
+
+// CSV fields only need quoting if they have commas, quotes, or newlines in them.
+inline std::string csvField(const std::string& s)
+{
+	if (s.find_first_of(",\"\n") == std::string::npos)
+		return s;
+	std::string quoted = "\"";
+	for (char c : s) {
+		if (c == '"')
+			quoted += '"';
+		quoted += c;
+	}
+	return quoted + '"';
+}
+
+// Pulls "name": value out of one of the result lines we write.
+// (This is nowhere near a JSON parser; it just reads our own output back in.)
+inline bool jsonField(const std::string& line, const std::string& name, std::string& value)
+{
+	const std::string key = "\"" + name + "\":";
+	size_t pos = line.find(key);
+	if (pos == std::string::npos)
+		return false;
+	pos = line.find_first_not_of(' ', pos + key.size());
+	if (pos == std::string::npos)
+		return false;
+	if (line[pos] == '"') {
+		const size_t end = line.find('"', pos + 1);
+		value = line.substr(pos + 1, end - pos - 1);
+	}
+	else {
+		const size_t end = line.find_first_of(",}", pos);
+		value = trim(line.substr(pos, end - pos));
+	}
+	return true;
+}
+
+inline std::vector<std::string> splitCSV(const std::string& line)
+{
+	std::vector<std::string> fields(1);
+	bool quoted = false;
+	for (size_t i = 0; i < line.size(); ++i) {
+		const char c = line[i];
+		if (quoted) {
+			if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+				fields.back() += line[++i];
+			else if (c == '"')
+				quoted = false;
+			else
+				fields.back() += c;
+		}
+		else if (c == '"') {
+			quoted = true;
+		}
+		else if (c == ',') {
+			fields.emplace_back();
+		}
+		else {
+			fields.back() += c;
+		}
+	}
+	return fields;
+}
+
+} // namespace detail
+
+inline HostInfo describeHost(const CacheTopology& topology)
+{
+	HostInfo h;
+#ifdef __linux__
+	char name[256] = "";
+	gethostname(name, sizeof(name) - 1);
+	h.hostname = name;
+	utsname u;
+	if (uname(&u) == 0)
+		h.kernel = std::string(u.sysname) + " " + u.release + " " + u.machine;
+#endif
+	h.cpu = detail::cpuModel();
+#ifdef __VERSION__
+#ifdef __clang__
+	h.compiler = "clang " __VERSION__;
+#else
+	h.compiler = "gcc " __VERSION__;
+#endif
+#endif
+	h.flags = detail::compilerFlags();
+
+	std::ostringstream caches;
+	for (const auto& c : topology.levels) {
+		if (!c.holdsData())
+			continue;
+		caches << "L" << c.level << (c.type == "Data" ? "d " : " ") << c.size / 1024 << "K, ";
+	}
+	caches << topology.lineSize() << " byte lines";
+	h.caches = caches.str();
+
+	char stamp[32];
+	const time_t now = time(nullptr);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	h.timestamp = stamp;
+	return h;
+}
+
+// Writes the results as one JSON object, with one result per line,
+// so that diffs (and readBaseline()) can go line by line.
+inline void writeJSON(std::ostream& out, const HostInfo& host, const std::vector<ResultRow>& rows)
+{
+	using detail::writeJSONString;
+	out << "{\n  \"host\": {";
+	const std::pair<const char*, const std::string*> fields[] = {
+		{ "hostname", &host.hostname }, { "cpu", &host.cpu }, { "kernel", &host.kernel },
+		{ "compiler", &host.compiler }, { "flags", &host.flags }, { "caches", &host.caches },
+		{ "timestamp", &host.timestamp },
+	};
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+		out << (i == 0 ? "" : ",") << "\n    \"" << fields[i].first << "\": ";
+		writeJSONString(out, *fields[i].second);
+	}
+	out << "\n  },\n  \"results\": [";
+
+	out << std::setprecision(9) << std::defaultfloat;
+	for (size_t i = 0; i < rows.size(); ++i) {
+		const ResultRow& r = rows[i];
+		const Summary& s = r.summary;
+		out << (i == 0 ? "" : ",") << "\n    {\"pattern\": ";
+		writeJSONString(out, r.pattern);
+		out << ", \"data_bytes\": " << r.dataBytes
+		    << ", \"elements\": " << r.elements
+		    << ", \"threads\": " << r.threads
+		    << ", \"batch\": " << r.batch
+		    << ", \"samples\": " << s.count
+		    << ", \"outliers\": " << s.outliers
+		    << ", \"min_ns\": " << s.min
+		    << ", \"median_ns\": " << s.median
+		    << ", \"p90_ns\": " << s.p90
+		    << ", \"p99_ns\": " << s.p99
+		    << ", \"max_ns\": " << s.max
+		    << ", \"mean_ns\": " << s.mean
+		    << ", \"stddev_ns\": " << s.stddev
+		    << ", \"ci95_ns\": " << s.ci95
+		    << ", \"ns_per_element\": " << r.nsPerElement()
+		    << ", \"gb_per_s\": " << r.gbPerSecond();
+		if (!r.counts.empty()) {
+			out << ", \"per_element\": {";
+			for (size_t c = 0; c < r.counts.size(); ++c) {
+				out << (c == 0 ? "" : ", ");
+				writeJSONString(out, r.counts[c].first);
+				out << ": " << r.counts[c].second;
+			}
+			out << "}";
+		}
+		out << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+// Writes the results as CSV, with the host information in # comments up top.
+// Counter columns are whichever counters the first result has.
+inline void writeCSV(std::ostream& out, const HostInfo& host, const std::vector<ResultRow>& rows)
+{
+	using detail::csvField;
+	out << "# hostname: " << host.hostname << "\n"
+	    << "# cpu: " << host.cpu << "\n"
+	    << "# kernel: " << host.kernel << "\n"
+	    << "# compiler: " << host.compiler << "\n"
+	    << "# flags: " << host.flags << "\n"
+	    << "# caches: " << host.caches << "\n"
+	    << "# timestamp: " << host.timestamp << "\n";
+
+	out << "pattern,data_bytes,elements,threads,batch,samples,outliers,min_ns,median_ns,"
+	       "p90_ns,p99_ns,max_ns,mean_ns,stddev_ns,ci95_ns,ns_per_element,gb_per_s";
+	std::vector<std::string> counters;
+	if (!rows.empty()) {
+		for (const auto& c : rows.front().counts) {
+			counters.push_back(c.first);
+			out << "," << csvField(c.first + " per element");
+		}
+	}
+	out << "\n";
+
+	out << std::setprecision(9) << std::defaultfloat;
+	for (const auto& r : rows) {
+		const Summary& s = r.summary;
+		out << csvField(r.pattern) << "," << r.dataBytes << "," << r.elements << ","
+		    << r.threads << "," << r.batch << "," << s.count << "," << s.outliers << ","
+		    << s.min << "," << s.median << "," << s.p90 << "," << s.p99 << "," << s.max << ","
+		    << s.mean << "," << s.stddev << "," << s.ci95 << ","
+		    << r.nsPerElement() << "," << r.gbPerSecond();
+		for (const auto& name : counters) {
+			out << ",";
+			for (const auto& c : r.counts) {
+				if (c.first == name)
+					out << c.second;
+			}
+		}
+		out << "\n";
+	}
+}
+
+namespace detail {
+
+// Escapes a label value for the OpenMetrics text format
+inline std::string metricLabel(const std::string& s)
+{
+	std::string escaped;
+	for (char c : s) {
+		if (c == '\\' || c == '"')
+			escaped += '\\';
+		if (c == '\n')
+			escaped += "\\n";
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+// The histograms' bucket boundaries: every power of two nanoseconds,
+// from 1 ns to 2^40 ns (about 18 minutes)
+constexpr unsigned int metricBucketOctaves = 41;
+
+// Writes one histogram family, in seconds, with a series for each result
+// that has anything in it. Every series has the same boundaries (above),
+// however its times are spread, so that Prometheus can aggregate them across
+// pushes; buckets are cumulative, as OpenMetrics wants, and empty ones are
+// still written. Each LatencyHistogram bucket is counted at the first
+// boundary it's wholly below, so the counts are as fine as those buckets are.
+inline void writeMetricHistogram(std::ostream& out, const std::string& name, const std::string& help,
+                                 const std::vector<ResultRow>& rows,
+                                 const LatencyHistogram ResultRow::*histogram)
+{
+	out << "# TYPE " << name << " histogram\n"
+	    << "# UNIT " << name << " seconds\n"
+	    << "# HELP " << name << " " << help << "\n";
+	for (const auto& r : rows) {
+		const LatencyHistogram& h = r.*histogram;
+		if (h.empty())
+			continue;
+		const std::string labels = "pattern=\"" + metricLabel(r.pattern) + "\",data_bytes=\"" +
+		                           std::to_string(r.dataBytes) + "\",threads=\"" +
+		                           std::to_string(r.threads) + "\"";
+		uint64_t seen = 0;
+		size_t b = 0;
+		for (unsigned int octave = 0; octave < metricBucketOctaves; ++octave) {
+			const double le = (double)((uint64_t)1 << octave);
+			for (; b + 1 < h.buckets() && LatencyHistogram::lowerBound(b + 1) * h.unitNs() <= le; ++b)
+				seen += h.bucketCount(b);
+			out << name << "_bucket{" << labels << ",le=\"" << le / 1e9 << "\"} " << seen << "\n";
+		}
+		out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << h.count() << "\n"
+		    << name << "_count{" << labels << "} " << h.count() << "\n"
+		    << name << "_sum{" << labels << "} " << h.sumNs() / 1e9 << "\n";
+	}
+}
+
+} // namespace detail
+
+// Writes the results in the OpenMetrics text format: the host as an info metric,
+// each result's median as a gauge, and its run (and chunk) times as histograms.
+inline void writeOpenMetrics(std::ostream& out, const HostInfo& host, const std::vector<ResultRow>& rows)
+{
+	using detail::metricLabel;
+	out << std::setprecision(9) << std::defaultfloat;
+	out << "# TYPE cache_demo_host info\n"
+	    << "# HELP cache_demo_host The machine the results came from\n"
+	    << "cache_demo_host_info{hostname=\"" << metricLabel(host.hostname)
+	    << "\",cpu=\"" << metricLabel(host.cpu)
+	    << "\",kernel=\"" << metricLabel(host.kernel)
+	    << "\",compiler=\"" << metricLabel(host.compiler)
+	    << "\",flags=\"" << metricLabel(host.flags)
+	    << "\",caches=\"" << metricLabel(host.caches) << "\"} 1\n";
+
+	out << "# TYPE cache_demo_median_seconds gauge\n"
+	    << "# UNIT cache_demo_median_seconds seconds\n"
+	    << "# HELP cache_demo_median_seconds Median time per call\n";
+	for (const auto& r : rows) {
+		out << "cache_demo_median_seconds{pattern=\"" << metricLabel(r.pattern)
+		    << "\",data_bytes=\"" << r.dataBytes << "\",threads=\"" << r.threads << "\"} "
+		    << r.summary.median / 1e9 << "\n";
+	}
+
+	detail::writeMetricHistogram(out, "cache_demo_call_seconds", "Time per call, run by run",
+	                             rows, &ResultRow::callTimes);
+	detail::writeMetricHistogram(out, "cache_demo_chunk_seconds", "Time per chunk of --histogram-chunk elements",
+	                             rows, &ResultRow::chunkTimes);
+	out << "# EOF\n";
+}
+
+// A baseline's median, keyed by pattern, data set size, and thread count
+using BaselineKey = std::tuple<std::string, size_t, size_t>;
+using Baseline = std::map<BaselineKey, double>;
+
+// Reads the medians back out of a file from writeJSON() or writeCSV().
+// Throws runtime_error if it can't.
+inline Baseline readBaseline(const std::string& path)
+{
+	std::ifstream in(path);
+	if (!in)
+		throw std::runtime_error("Couldn't open the baseline " + path);
+
+	Baseline baseline;
+	std::string line;
+	std::vector<std::string> header;
+	bool json = false;
+	while (std::getline(in, line)) {
+		const std::string trimmed = detail::trim(line);
+		if (trimmed.empty() || trimmed[0] == '#')
+			continue;
+		// Our JSON starts with a line that's just the opening brace.
+		if (header.empty() && !json && trimmed == "{") {
+			json = true;
+			continue;
+		}
+
+		if (json) {
+			std::string pattern, bytes, threads, median;
+			if (detail::jsonField(trimmed, "pattern", pattern) &&
+			    detail::jsonField(trimmed, "data_bytes", bytes) &&
+			    detail::jsonField(trimmed, "threads", threads) &&
+			    detail::jsonField(trimmed, "median_ns", median)) {
+				baseline[BaselineKey(pattern, std::stoull(bytes), std::stoull(threads))] = std::stod(median);
+			}
+			continue;
+		}
+
+		const std::vector<std::string> fields = detail::splitCSV(trimmed);
+		if (header.empty()) {
+			header = fields;
+			continue;
+		}
+		std::map<std::string, std::string> row;
+		for (size_t i = 0; i < fields.size() && i < header.size(); ++i)
+			row[header[i]] = fields[i];
+		if (row.count("pattern") && row.count("data_bytes") && row.count("threads") && row.count("median_ns")) {
+			baseline[BaselineKey(row["pattern"], std::stoull(row["data_bytes"]),
+			                     std::stoull(row["threads"]))] = std::stod(row["median_ns"]);
+		}
+	}
+
+	if (baseline.empty())
+		throw std::runtime_error("The baseline " + path + " doesn't have any results in it");
+	return baseline;
+}
+
+// Prints how each result compares to the baseline, and returns how many
+// got slower by more than the threshold (a fraction, e.g., 0.05 for 5%).
+// If compared isn't null, it's set to how many results were in the baseline at all.
+inline size_t compareToBaseline(std::ostream& out, const std::vector<ResultRow>& rows,
+                                const Baseline& baseline, double threshold, size_t* compared = nullptr)
+{
+	size_t regressions = 0;
+	if (compared)
+		*compared = 0;
+	out << "\nCompared to the baseline (failing anything over " << std::fixed
+	    << std::setprecision(1) << threshold * 100 << "% slower):\n";
+	out << std::setw(24) << "pattern" << std::setw(12) << "data set" << std::setw(14) << "baseline"
+	    << std::setw(14) << "now" << std::setw(10) << "change" << "\n";
+	for (const auto& r : rows) {
+		const auto it = baseline.find(BaselineKey(r.pattern, r.dataBytes, r.threads));
+		out << std::setw(24) << r.pattern << std::setw(12) << r.dataBytes / 1024 << "K";
+		if (it == baseline.end()) {
+			out << std::setw(13) << "-" << std::setw(14) << formatTime(r.summary.median)
+			    << "  (not in the baseline)\n";
+			continue;
+		}
+		if (compared)
+			++*compared;
+		const double change = r.summary.median / it->second - 1;
+		const bool regressed = change > threshold;
+		if (regressed)
+			++regressions;
+		out << std::setw(13) << formatTime(it->second) << std::setw(14) << formatTime(r.summary.median)
+		    << std::setw(9) << std::showpos << std::setprecision(1) << change * 100 << std::noshowpos
+		    << "%" << (regressed ? "  REGRESSION" : "") << "\n";
+	}
+	return regressions;
+}
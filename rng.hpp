@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CACHE_DEMO_X86 1 // As in simd.hpp, which we can't include, since it needs patterns.hpp
+#endif
+
+#include "cpus.hpp"
+
+// Filling the data set with random numbers, quickly.
+//
+// Stepping default_random_engine through uniform_int_distribution one int
+// at a time costs more than most of the walks we're timing, and we do it
+// before every iteration. Instead, each element is a hash of its index
+// and a key (a "counter-based" generator, like Philox), so any chunk of the
+// data set can be filled without knowing what came before it:
+// the loop has no dependencies from one element to the next,
+// so it vectorizes nicely, and threads can each take a chunk.
+//
+// Shuffles can't be split up like that, but they can at least use
+// a faster generator than default_random_engine.
+
+namespace kernels {
+
+// A good 32-bit integer hash (Chris Wellons' "lowbias32"),
+// made of operations every SIMD instruction set has.
+inline uint32_t mix32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// Maps a hash onto [0, range) with ((hash >> 16) * range) >> 16,
+// which stays in 32 bits (so SIMD can do it too) and has a bias of at most
+// range / 2^16. That's nothing for the handful of values we use.
+inline uint32_t scaleHash(uint32_t h, uint32_t range) { return ((h >> 16) * range) >> 16; }
+
+// Fills out[0, n) with values in [low, low + range), where out[i]'s value
+// depends only on the key and first + i. Range can be at most 2^16.
+inline void fillRandomScalar(int* out, size_t n, uint64_t key, uint32_t first, int low, uint32_t range)
+{
+	const uint32_t k0 = (uint32_t)key;
+	const uint32_t k1 = (uint32_t)(key >> 32);
+	for (size_t i = 0; i < n; ++i) {
+		const uint32_t h = mix32(mix32((first + (uint32_t)i) ^ k0) + k1);
+		out[i] = low + (int)scaleHash(h, range);
+	}
+}
+
+#ifdef CACHE_DEMO_X86
+
+__attribute__((target("avx2")))
+inline __m256i mix32AVX2(__m256i x)
+{
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x7feb352du));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68bu));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	return x;
+}
+
+// The same as fillRandomScalar(), eight at a time
+__attribute__((target("avx2")))
+inline void fillRandomAVX2(int* out, size_t n, uint64_t key, uint32_t first, int low, uint32_t range)
+{
+	const __m256i k0 = _mm256_set1_epi32((int)(uint32_t)key);
+	const __m256i k1 = _mm256_set1_epi32((int)(uint32_t)(key >> 32));
+	const __m256i r = _mm256_set1_epi32((int)range);
+	const __m256i l = _mm256_set1_epi32(low);
+	const __m256i eight = _mm256_set1_epi32(8);
+	__m256i counter = _mm256_add_epi32(_mm256_set1_epi32((int)first),
+	                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i h = mix32AVX2(_mm256_add_epi32(mix32AVX2(_mm256_xor_si256(counter, k0)), k1));
+		const __m256i scaled = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(h, 16), r), 16);
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi32(scaled, l));
+		counter = _mm256_add_epi32(counter, eight);
+	}
+	fillRandomScalar(out + i, n - i, key, first + (uint32_t)i, low, range);
+}
+
+#endif // CACHE_DEMO_X86
+
+inline void fillRandom(int* out, size_t n, uint64_t key, uint32_t first, int low, uint32_t range)
+{
+#ifdef CACHE_DEMO_X86
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2) {
+		fillRandomAVX2(out, n, key, first, low, range);
+		return;
+	}
+#endif
+	fillRandomScalar(out, n, key, first, low, range);
+}
+
+} // namespace kernels
+
+// Fills data[0, n) with values in [low, high] derived from the key
+// (with at most 2^16 values between them),
+// splitting the work between threads if there's enough of it.
+// The result is the same regardless of how many threads there are.
+inline void fillRandomParallel(int* data, size_t n, uint64_t key, int low, int high)
+{
+	const uint32_t range = (uint32_t)(high - low + 1);
+
+	// Counters are 32 bits, so give each 2^32 elements its own key.
+	auto fill = [=](size_t first, size_t last) {
+		while (first < last) {
+			const size_t block = first >> 32;
+			const size_t blockEnd = std::min(last, (block + 1) << 32);
+			kernels::fillRandom(data + first, blockEnd - first,
+			                    key ^ (block * 0x9e3779b97f4a7c15ull), (uint32_t)first, low, range);
+			first = blockEnd;
+		}
+	};
+
+	// Below a few megabytes, starting threads costs more than it saves.
+	const size_t minPerThread = 1 << 20;
+	const size_t threads = std::min<size_t>(processCPUs.size(), std::max<size_t>(n / minPerThread, 1));
+	if (threads == 1) {
+		fill(0, n);
+		return;
+	}
+
+	const size_t chunk = (n + threads - 1) / threads;
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; ++t) {
+		// These would start out pinned to the same CPU as we are,
+		// if a ThreadTeam has pinned us, so let them go anywhere we could have at first.
+		workers.emplace_back([=] {
+			allowThisThread(processCPUs);
+			fill(std::min(n, t * chunk), std::min(n, (t + 1) * chunk));
+		});
+	}
+	fill(0, std::min(n, chunk));
+	for (auto& w : workers)
+		w.join();
+}
+
+// Draws a 64-bit key from the standard engine, which only gives us 31 bits at a time
+inline uint64_t drawKey(std::default_random_engine& re)
+{
+	const uint64_t high = re();
+	return (high << 32) ^ (high >> 8) ^ re();
+}
+
+// Vigna's SplitMix64: tiny, fast, and plenty random for shuffling
+class SplitMix64 {
+public:
+	explicit SplitMix64(uint64_t seed) : state(seed) { }
+
+	uint64_t next()
+	{
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	// A uniformly distributed value in [0, bound), by Lemire's
+	// multiply-and-shift method (which almost never needs a division).
+	uint32_t below(uint32_t bound)
+	{
+		uint64_t m = (next() >> 32) * bound;
+		if ((uint32_t)m < bound) {
+			const uint32_t threshold = (uint32_t)(-bound) % bound;
+			while ((uint32_t)m < threshold)
+				m = (next() >> 32) * bound;
+		}
+		return (uint32_t)(m >> 32);
+	}
+
+private:
+	uint64_t state;
+};
+
+// Fills out[0, n) with a random permutation of [0, n) derived from the key.
+// If cyclic is set, it's a single cycle through every element
+// (i -> out[i] -> out[out[i]] -> ... visits them all before coming back to i),
+// from Sattolo's algorithm: Fisher-Yates, except that element i never swaps
+// with itself. A plain shuffle would give us a bunch of smaller cycles instead.
+inline void generatePermutation(uint32_t* out, size_t n, uint64_t key, bool cyclic)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = (uint32_t)i;
+
+	SplitMix64 rng(key);
+	for (size_t i = n; i > 1; --i) {
+		const uint32_t j = cyclic ? rng.below((uint32_t)(i - 1)) : rng.below((uint32_t)i);
+		std::swap(out[i - 1], out[j]);
+	}
+}
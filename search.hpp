@@ -0,0 +1,429 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "patterns.hpp"
+#include "rng.hpp"
+
+// Searching sorted data: how much does the layout matter?
+//
+// Every one of these looks up the same random keys in the same sorted keys:
+// the running sums of the data set, which go up by 1 to 10 at a time,
+// so there's one key per element and the tree is as big as the data set.
+// (Past 2^32 / 10 elements, the steps are capped so that the sums still fit
+// in 32 bits, and past 2^32 - 2 elements, only that many are made into keys.)
+// Each pattern stores them differently:
+//
+// - search-binary: a sorted array, binary searched. Every probe of the
+//   first dozen or so levels is a miss, to a line that holds only the one
+//   key we want, and the branch on each comparison is a coin flip.
+// - search-binary-branchless: the same search, but picking the next half with
+//   a conditional move instead of a branch, so there's nothing to mispredict
+//   (but also nothing to speculate down, so each load waits for the last).
+// - search-eytzinger: the keys in breadth-first order (the children of
+//   node k are 2k and 2k + 1), so the top of the tree is packed together
+//   at the front, and stays in cache.
+// - search-eytzinger-prefetch: the same, prefetching the node's great-great-
+//   grandchildren, which are the 16 keys of one cache line, four levels down.
+//   That's a little more memory traffic for four lookups' worth of latency.
+// - search-veb: the van Emde Boas layout, which splits the tree in half by height,
+//   lays out the top half, then each subtree hanging off it, recursively.
+//   Any subtree of height h is in one block of 2^h keys, so it's efficient for
+//   every block size at once (lines, pages, ...), without knowing any of them.
+// - search-btree: a static B-tree with 16 keys per node (one cache line),
+//   and 17 children per node at implicit positions, so no pointers.
+//   Each node is searched with a branchy linear scan.
+// - search-btree-branchless: the same, counting the keys in the node that are
+//   smaller than ours 16 at a time, which is also which child to go to.
+//
+// Each run looks up searchLookups keys, and sums what it finds, so an element
+// is one lookup. The lookups are drawn afresh whenever the data is,
+// from the data set's key, so every layout is timed on the same ones. The working set sweep
+// (--search-sweep) reports lookups per second at each data set size.
+
+namespace detail {
+
+// How many keys each search run looks up
+constexpr size_t searchLookups = 1 << 16;
+
+// The search key for "no key": bigger than any real one
+constexpr uint32_t noKey = std::numeric_limits<uint32_t>::max();
+
+// The keys, as a sorted array
+template <bool Branchless>
+class SortedLayout {
+public:
+	void build(const uint32_t* sorted, size_t n) { keys.assign(sorted, sorted + n); }
+
+	// The first key >= x, which the caller promises there is
+	uint32_t lowerBound(uint32_t x) const
+	{
+		const uint32_t* base = keys.data();
+		size_t n = keys.size();
+		if (!Branchless) {
+			size_t low = 0;
+			size_t high = n;
+			while (low < high) {
+				const size_t middle = low + (high - low) / 2;
+				if (base[middle] < x)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			return base[low];
+		}
+
+		while (n > 1) {
+			const size_t half = n / 2;
+			base = base[half] < x ? base + half : base;
+			n -= half;
+		}
+		return base[*base < x];
+	}
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		out.push_back({keys.data(), keys.size() * sizeof(uint32_t)});
+	}
+
+private:
+	PagedVector<uint32_t> keys;
+};
+
+// The keys in breadth-first (Eytzinger) order, from index 1.
+// Since the array starts on a page boundary, keys 16k to 16k + 15
+// (the descendants of k / 16, four levels down) are one cache line.
+template <bool Prefetch>
+class EytzingerLayout {
+public:
+	void build(const uint32_t* sorted, size_t n)
+	{
+		keys.resize(n + 1);
+		keys[0] = noKey;
+		size_t next = 0;
+		fill(sorted, next, 1);
+	}
+
+	uint32_t lowerBound(uint32_t x) const
+	{
+		const uint32_t* b = keys.data();
+		const size_t n = keys.size() - 1;
+		size_t k = 1;
+		while (k <= n) {
+			if (Prefetch)
+				__builtin_prefetch((const char*)b + k * 16 * sizeof(uint32_t));
+			k = 2 * k + (b[k] < x);
+		}
+		// Each right turn appended a 1 to k, and each left turn a 0.
+		// Undo the right turns since the last left one, and the left one itself,
+		// to get back to the last node we went left at, which is the one we want.
+		k >>= __builtin_ffsll((long long)~k);
+		return b[k];
+	}
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		out.push_back({keys.data(), keys.size() * sizeof(uint32_t)});
+	}
+
+private:
+	PagedVector<uint32_t> keys;
+
+	// An in-order walk of the tree hands out the sorted keys in order.
+	void fill(const uint32_t* sorted, size_t& next, size_t k)
+	{
+		if (k >= keys.size())
+			return;
+		fill(sorted, next, 2 * k);
+		keys[k] = sorted[next++];
+		fill(sorted, next, 2 * k + 1);
+	}
+};
+
+// The keys in a complete binary tree (padded out with noKey), in van Emde Boas order.
+//
+// Searching it needs to know where in memory each node on the path is.
+// Following Brodal, Fagerberg and Jacob, that only depends on the node's depth d
+// and its breadth-first index: d is the root of one of the bottom subtrees of exactly
+// one split, whose own root is at depth above[d], so it's that subtree's root's
+// position, plus the size of its top half, plus the size of a bottom subtree
+// times which of them (the low d - above[d] bits of its index) it is.
+class VebLayout {
+public:
+	void build(const uint32_t* sorted, size_t n)
+	{
+		height = 1;
+		while ((((size_t)1 << height) - 1) < n)
+			++height;
+		keys.resize(((size_t)1 << height) - 1);
+		split(0, height);
+
+		this->sorted = sorted;
+		this->n = n;
+		place(1, 0, height, 0);
+		this->sorted = nullptr;
+	}
+
+	uint32_t lowerBound(uint32_t x) const
+	{
+		const uint32_t* t = keys.data();
+		size_t position[64];
+		position[0] = 0;
+		size_t k = 1;
+		uint32_t found = noKey;
+		for (unsigned int d = 0; d < height; ++d) {
+			if (d > 0) {
+				const Depth& depth = depths[d];
+				position[d] = position[depth.above] + depth.topSize + (k & depth.mask) * depth.bottomSize;
+			}
+			const uint32_t key = t[position[d]];
+			// Each key we go left at is smaller than the last,
+			// so the last one is the smallest key >= x.
+			found = key >= x ? key : found;
+			k = 2 * k + (key < x);
+		}
+		return found;
+	}
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		out.push_back({keys.data(), keys.size() * sizeof(uint32_t)});
+	}
+
+private:
+	// For the nodes at some depth
+	struct Depth {
+		unsigned int above = 0; // The depth of the root of the subtree they're bottom roots in
+		size_t topSize = 0; // The size of that subtree's top half
+		size_t bottomSize = 0; // The size of each of its bottom subtrees
+		size_t mask = 0; // Picks which bottom subtree out of the breadth-first index
+	};
+
+	PagedVector<uint32_t> keys;
+	unsigned int height = 0;
+	Depth depths[64];
+
+	// Only while building
+	const uint32_t* sorted = nullptr;
+	size_t n = 0;
+
+	// Splits the subtree of the given height, rooted at the given depth,
+	// into a top half and bottom halves, and the halves likewise.
+	void split(unsigned int root, unsigned int h)
+	{
+		if (h <= 1)
+			return;
+		const unsigned int top = h / 2;
+		const unsigned int bottom = h - top;
+		Depth& d = depths[root + top];
+		d.above = root;
+		d.topSize = ((size_t)1 << top) - 1;
+		d.bottomSize = ((size_t)1 << bottom) - 1;
+		d.mask = ((size_t)1 << top) - 1;
+		split(root, top);
+		split(root + top, bottom);
+	}
+
+	// Lays out the subtree of height h rooted at breadth-first index k
+	// (at depth d) starting at start, the same way split() divided it up.
+	void place(size_t k, unsigned int d, unsigned int h, size_t start)
+	{
+		if (h == 1) {
+			// In a complete tree, a node's in-order rank follows from where it is.
+			const size_t rank = ((k - ((size_t)1 << d)) * 2 + 1) * ((size_t)1 << (height - 1 - d)) - 1;
+			keys[start] = rank < n ? sorted[rank] : noKey;
+			return;
+		}
+		const unsigned int top = h / 2;
+		const unsigned int bottom = h - top;
+		place(k, d, top, start);
+		const size_t topSize = ((size_t)1 << top) - 1;
+		const size_t bottomSize = ((size_t)1 << bottom) - 1;
+		for (size_t j = 0; j < ((size_t)1 << top); ++j)
+			place((k << top) + j, d + top, bottom, start + topSize + j * bottomSize);
+	}
+};
+
+// The keys in a static B-tree (an "S-tree") of cache-line nodes, with the
+// children of node k at k * 17 + 1 to k * 17 + 17, padded out with noKey.
+template <bool Branchless>
+class BTreeLayout {
+public:
+	static constexpr size_t NodeKeys = 16;
+
+	void build(const uint32_t* sorted, size_t n)
+	{
+		nodes = (n + NodeKeys - 1) / NodeKeys;
+		keys.resize(nodes * NodeKeys);
+		this->sorted = sorted;
+		this->n = n;
+		size_t next = 0;
+		fill(next, 0);
+		this->sorted = nullptr;
+	}
+
+	uint32_t lowerBound(uint32_t x) const
+	{
+		const uint32_t* t = keys.data();
+		uint32_t found = noKey;
+		size_t k = 0;
+		while (k < nodes) {
+			const uint32_t* node = t + k * NodeKeys;
+			const size_t i = Branchless ? countLess(node, x) : scan(node, x);
+			if (i < NodeKeys)
+				found = node[i];
+			k = child(k, i);
+		}
+		return found;
+	}
+
+	void regions(std::vector<MemoryRegion>& out) const
+	{
+		out.push_back({keys.data(), keys.size() * sizeof(uint32_t)});
+	}
+
+private:
+	PagedVector<uint32_t> keys;
+	size_t nodes = 0;
+
+	// Only while building
+	const uint32_t* sorted = nullptr;
+	size_t n = 0;
+
+	static size_t child(size_t k, size_t i) { return k * (NodeKeys + 1) + i + 1; }
+
+	// An in-order walk again: each key comes after the subtree to its left.
+	void fill(size_t& next, size_t k)
+	{
+		if (k >= nodes)
+			return;
+		for (size_t i = 0; i < NodeKeys; ++i) {
+			fill(next, child(k, i));
+			keys[k * NodeKeys + i] = next < n ? sorted[next++] : noKey;
+		}
+		fill(next, child(k, NodeKeys));
+	}
+
+	// Where x goes in the node: the first key >= x
+	static size_t scan(const uint32_t* node, uint32_t x)
+	{
+		size_t i = 0;
+		while (i < NodeKeys && node[i] < x)
+			++i;
+		return i;
+	}
+
+	// The same, as the number of keys < x, compared all at once.
+	static size_t countLess(const uint32_t* node, uint32_t x)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		// SSE2 only compares signed ints, so flip the top bits first.
+		const __m128i bias = _mm_set1_epi32((int)0x80000000);
+		const __m128i target = _mm_xor_si128(_mm_set1_epi32((int)x), bias);
+		__m128i less[4];
+		for (int j = 0; j < 4; ++j) {
+			const __m128i k = _mm_xor_si128(_mm_load_si128((const __m128i*)node + j), bias);
+			less[j] = _mm_cmpgt_epi32(target, k);
+		}
+		// Narrow the four masks down to one byte per key, and count them.
+		const __m128i packed = _mm_packs_epi16(_mm_packs_epi32(less[0], less[1]), _mm_packs_epi32(less[2], less[3]));
+		return (size_t)__builtin_popcount((unsigned int)_mm_movemask_epi8(packed));
+#else
+		size_t count = 0;
+		for (size_t i = 0; i < NodeKeys; ++i)
+			count += node[i] < x;
+		return count;
+#endif
+	}
+};
+
+} // namespace detail
+
+// Looks up random keys among the running sums of the data set,
+// stored in the given layout, which needs build(sorted, n),
+// lowerBound(x) (the first key >= x, which there always is),
+// and regions(out) (where its memory is).
+template <typename Layout>
+class SearchPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		// Every key has to be smaller than noKey.
+		const size_t maxKeys = detail::noKey - 1;
+		data = &d;
+		sorted.resize(std::min(d.size(), maxKeys));
+		// The data is between 1 and 10, so the sums fit up to 2^32 / 10 elements.
+		// Past that, we take each step modulo a smaller limit instead.
+		stepLimit = (uint32_t)std::min<size_t>(10, maxKeys / sorted.size());
+		lookups.resize(detail::searchLookups);
+	}
+
+	// The keys are rebuilt from the data every time it changes,
+	// and the lookups redrawn from its key (not the engine, which every pattern
+	// in the run draws from in turn), so that they're the same for every layout.
+	void prepare(std::default_random_engine&) override
+	{
+		const int* d = data->data();
+		uint32_t sum = 0;
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			sum += 1 + (uint32_t)(std::max(d[i], 1) - 1) % stepLimit;
+			sorted[i] = sum;
+		}
+		layout.build(sorted.data(), sorted.size());
+
+		SplitMix64 rng(data->key);
+		for (auto& l : lookups)
+			l = 1 + rng.below(sum);
+	}
+
+	size_t size() const override { return lookups.size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		uint64_t sum = 0;
+		for (size_t i = first; i < last; ++i)
+			sum += layout.lowerBound(lookups[i]);
+		return sum;
+	}
+
+	// Just the key we look up: how much of the tree each lookup reads
+	// depends on how much of it is cached, which is the point.
+	// (So GB/s doesn't mean much here; lookups per second does.)
+	double bytesPerElement() const override { return sizeof(uint32_t); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		layout.regions(regions);
+		regions.push_back({lookups.data(), lookups.size() * sizeof(uint32_t)});
+	}
+
+private:
+	const DataSet* data = nullptr;
+	PagedVector<uint32_t> sorted; // The keys, for building the layout from
+	uint32_t stepLimit = 10; // The most any key is bigger than the last
+	PagedVector<uint32_t> lookups;
+	Layout layout;
+};
+
+inline const RegisterPattern<SearchPattern<detail::SortedLayout<false>>> registerSearchBinary(
+	"search-binary", "Look up random keys in a sorted array of the data set's running sums");
+inline const RegisterPattern<SearchPattern<detail::SortedLayout<true>>> registerSearchBinaryBranchless(
+	"search-binary-branchless", "Search-binary, with conditional moves instead of branches");
+inline const RegisterPattern<SearchPattern<detail::EytzingerLayout<false>>> registerSearchEytzinger(
+	"search-eytzinger", "Same keys, in breadth-first (Eytzinger) order");
+inline const RegisterPattern<SearchPattern<detail::EytzingerLayout<true>>> registerSearchEytzingerPrefetch(
+	"search-eytzinger-prefetch", "Search-eytzinger, prefetching four levels ahead");
+inline const RegisterPattern<SearchPattern<detail::VebLayout>> registerSearchVeb(
+	"search-veb", "Same keys, in van Emde Boas order");
+inline const RegisterPattern<SearchPattern<detail::BTreeLayout<false>>> registerSearchBTree(
+	"search-btree", "Same keys, in a static B-tree of cache-line nodes");
+inline const RegisterPattern<SearchPattern<detail::BTreeLayout<true>>> registerSearchBTreeBranchless(
+	"search-btree-branchless", "Search-btree, comparing all of a node's keys at once");
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "memory.hpp"
+#include "patterns.hpp"
+#include "threads.hpp"
+
+// False sharing: threads that never touch each other's data,
+// but still fight over the cache lines it's on.
+//
+// Each member of the thread team (see threads.hpp) bumps a counter of its own,
+// over and over. Only one core can write to a line at a time,
+// so if two counters share one, it bounces between their cores
+// on every increment, even though no counter is ever touched by two threads.
+// Run these with --threads (or --scaling); on one thread, every layout is the same.
+//
+// - counters-packed puts the counters right next to each other, 8 to a line,
+//   like an array of per-thread stats.
+// - counters-padded64 gives each counter a cache line of its own.
+// - counters-padded128 gives each one a pair of lines, since Intel's
+//   spatial prefetcher likes to pull in lines two at a time, so neighbours
+//   one line apart can still get in each other's way.
+// - counters-per-page gives each counter a page of its own, which its thread
+//   touches first, so that Linux puts it on that thread's NUMA node
+//   (with --pages=4k, the default: a huge page holds every counter).
+//
+// Each comes in a plain version, where each increment is an ordinary load and
+// store, and an -atomic one, where it's a locked read-modify-write (which has
+// to own the line to do anything at all). counter-shared-atomic has every thread
+// increment the same counter, for comparison: that's true sharing,
+// which no amount of padding can fix.
+//
+// These ignore the data set. Each run does a fixed number of increments
+// between all the threads, so "per element" means per increment.
+
+namespace detail {
+
+// Enough counters for one per CPU, or at least as many as a team could use
+inline size_t counterSlots()
+{
+	return std::max<size_t>(availableCPUs().size(), 64);
+}
+
+inline size_t pageSize()
+{
+#ifdef __linux__
+	return (size_t)sysconf(_SC_PAGESIZE);
+#else
+	return 4096;
+#endif
+}
+
+} // namespace detail
+
+// How far apart the counters are, or 0 for all threads sharing one
+// (or -1 for a page apart, since we don't know how big a page is until we run).
+template <long Spacing, bool Atomic>
+class CounterPattern : public AccessPattern {
+public:
+	CounterPattern() = default;
+	CounterPattern(const CounterPattern&) = delete;
+	CounterPattern& operator=(const CounterPattern&) = delete;
+
+	~CounterPattern() { release(); }
+
+	void setup(DataSet&) override
+	{
+		release();
+		spacing = Spacing >= 0 ? (size_t)Spacing : detail::pageSize();
+		slots = Spacing == 0 ? 1 : detail::counterSlots();
+		bytes = std::max<size_t>(spacing, sizeof(uint64_t)) * slots;
+
+		// The memory comes from mmap() (on Linux, anyway), so it's already zeroed,
+		// and each page stays untouched until something uses it.
+		// Let each thread be the first to touch its own page, if they have them.
+		counters = PageAllocator<uint8_t>().allocate(bytes);
+		if (Spacing >= 0)
+			memset(counters, 0, bytes);
+	}
+
+	size_t size() const override { return incrementsPerRun; }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		uint64_t* counter = (uint64_t*)(counters + (teamMember() % slots) * spacing);
+		for (size_t i = first; i < last; ++i) {
+			if (Atomic)
+				__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+			else {
+				// Volatile, so the compiler does every load and store
+				// instead of adding the lot up in a register.
+				volatile uint64_t* v = counter;
+				*v = *v + 1;
+			}
+		}
+		return last - first;
+	}
+
+	// Each increment reads a counter and writes it back.
+	double bytesPerElement() const override { return 2 * sizeof(uint64_t); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		// Flushing the pages would touch them before their threads do.
+		if (Spacing >= 0)
+			regions.push_back({counters, bytes});
+	}
+
+private:
+	static constexpr size_t incrementsPerRun = 1 << 16;
+
+	uint8_t* counters = nullptr;
+	size_t spacing = 0;
+	size_t slots = 0;
+	size_t bytes = 0;
+
+	void release()
+	{
+		if (counters != nullptr)
+			PageAllocator<uint8_t>().deallocate(counters, bytes);
+		counters = nullptr;
+	}
+};
+
+inline const RegisterPattern<CounterPattern<8, false>> registerPacked(
+	"counters-packed", "Each thread increments its own counter, packed 8 to a cache line");
+inline const RegisterPattern<CounterPattern<8, true>> registerPackedAtomic(
+	"counters-packed-atomic", "Same, with atomic increments");
+inline const RegisterPattern<CounterPattern<64, false>> registerPadded64(
+	"counters-padded64", "Same as counters-packed, but a line each");
+inline const RegisterPattern<CounterPattern<64, true>> registerPadded64Atomic(
+	"counters-padded64-atomic", "Same, with atomic increments");
+inline const RegisterPattern<CounterPattern<128, false>> registerPadded128(
+	"counters-padded128", "Same as counters-packed, but two lines each");
+inline const RegisterPattern<CounterPattern<128, true>> registerPadded128Atomic(
+	"counters-padded128-atomic", "Same, with atomic increments");
+inline const RegisterPattern<CounterPattern<-1, false>> registerPerPage(
+	"counters-per-page", "Same as counters-packed, but a page each, on its thread's NUMA node");
+inline const RegisterPattern<CounterPattern<-1, true>> registerPerPageAtomic(
+	"counters-per-page-atomic", "Same, with atomic increments");
+inline const RegisterPattern<CounterPattern<0, true>> registerShared(
+	"counter-shared-atomic", "Every thread atomically increments the same counter");
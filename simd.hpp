@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CACHE_DEMO_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CACHE_DEMO_NEON 1
+#endif
+
+#include "patterns.hpp"
+
+// Hand-written versions of the contiguous pattern's sum of squares,
+// one per instruction set, so that we know exactly what the CPU is doing
+// instead of relying on whatever the auto-vectorizer comes up with.
+// Comparing these against each other (and against the indirect patterns)
+// shows how much of the time goes to computing and how much to waiting on memory.
+//
+// Every kernel squares each int into 64 bits, so none of them overflow,
+// and they all return the same sum.
+
+// Sums the squares of n ints
+using SumSquaresKernel = uint64_t (*)(const int*, size_t);
+
+namespace kernels {
+
+// The plain loop, with the auto-vectorizer turned off
+#if defined(__clang__)
+inline uint64_t sumSquaresScalar(const int* p, size_t n)
+{
+	uint64_t sum = 0;
+#pragma clang loop vectorize(disable) interleave(disable)
+	for (size_t i = 0; i < n; ++i)
+		sum += (int64_t)p[i] * p[i];
+	return sum;
+}
+#else
+__attribute__((optimize("no-tree-vectorize")))
+inline uint64_t sumSquaresScalar(const int* p, size_t n)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < n; ++i)
+		sum += (int64_t)p[i] * p[i];
+	return sum;
+}
+#endif
+
+#ifdef CACHE_DEMO_X86
+
+// SSE2 can only multiply unsigned 32-bit values into 64 bits,
+// so square the absolute value of each int instead
+// (which is fine, since (-x)² = x²).
+// Even INT_MIN works, since its "absolute value" 0x80000000 is right as unsigned.
+inline uint64_t sumSquaresSSE2(const int* p, size_t n)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		const __m128i sign = _mm_srai_epi32(v, 31);
+		const __m128i a = _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+		// _mm_mul_epu32 multiplies the even lanes, so shift the odd ones down.
+		const __m128i odd = _mm_srli_epi64(a, 32);
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(a, a));
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(odd, odd));
+	}
+
+	alignas(16) uint64_t lanes[2];
+	_mm_store_si128((__m128i*)lanes, acc);
+	uint64_t sum = lanes[0] + lanes[1];
+	for (; i < n; ++i)
+		sum += (int64_t)p[i] * p[i];
+	return sum;
+}
+
+// AVX2 has a signed 32 -> 64 bit multiply, but only of the even lanes,
+// so shift the odd ones down and do them separately.
+// Using two accumulators means consecutive adds don't have to wait on each other.
+__attribute__((target("avx2")))
+inline void accumulateSquaresAVX2(__m256i v, __m256i& acc0, __m256i& acc1)
+{
+	const __m256i odd = _mm256_srli_epi64(v, 32);
+	acc0 = _mm256_add_epi64(acc0, _mm256_mul_epi32(v, v));
+	acc1 = _mm256_add_epi64(acc1, _mm256_mul_epi32(odd, odd));
+}
+
+__attribute__((target("avx2")))
+inline uint64_t horizontalSumAVX2(__m256i acc0, __m256i acc1)
+{
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+inline uint64_t sumSquaresAVX2(const int* p, size_t n)
+{
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		accumulateSquaresAVX2(_mm256_loadu_si256((const __m256i*)(p + i)), acc0, acc1);
+
+	uint64_t sum = horizontalSumAVX2(acc0, acc1);
+	for (; i < n; ++i)
+		sum += (int64_t)p[i] * p[i];
+	return sum;
+}
+
+// GCC 12's AVX-512 headers trip its own uninitialized variable warnings
+// (GCC bug 105593), so quiet those for these functions.
+// gather.hpp does the same for its AVX-512 kernel.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f")))
+inline void accumulateSquaresAVX512(__m512i v, __m512i& acc0, __m512i& acc1)
+{
+	const __m512i odd = _mm512_srli_epi64(v, 32);
+	acc0 = _mm512_add_epi64(acc0, _mm512_mul_epi32(v, v));
+	acc1 = _mm512_add_epi64(acc1, _mm512_mul_epi32(odd, odd));
+}
+
+__attribute__((target("avx512f")))
+inline uint64_t horizontalSumAVX512(__m512i acc0, __m512i acc1)
+{
+	return (uint64_t)_mm512_reduce_add_epi64(_mm512_add_epi64(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+inline uint64_t sumSquaresAVX512(const int* p, size_t n)
+{
+	__m512i acc0 = _mm512_setzero_si512();
+	__m512i acc1 = _mm512_setzero_si512();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		accumulateSquaresAVX512(_mm512_loadu_si512((const void*)(p + i)), acc0, acc1);
+
+	uint64_t sum = horizontalSumAVX512(acc0, acc1);
+	for (; i < n; ++i)
+		sum += (int64_t)p[i] * p[i];
+	return sum;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+inline bool haveAVX2() { return __builtin_cpu_supports("avx2"); }
+inline bool haveAVX512() { return __builtin_cpu_supports("avx512f"); }
+
+#endif // CACHE_DEMO_X86
+
+#ifdef CACHE_DEMO_NEON
+
+// NEON (which every AArch64 CPU has) can multiply-accumulate
+// 32-bit lanes straight into 64-bit ones.
+inline uint64_t sumSquaresNEON(const int* p, size_t n)
+{
+	int64x2_t acc0 = vdupq_n_s64(0);
+	int64x2_t acc1 = vdupq_n_s64(0);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const int32x4_t v = vld1q_s32(p + i);
+		acc0 = vmlal_s32(acc0, vget_low_s32(v), vget_low_s32(v));
+		acc1 = vmlal_high_s32(acc1, v, v);
+	}
+
+	uint64_t sum = (uint64_t)vaddvq_s64(vaddq_s64(acc0, acc1));
+	for (; i < n; ++i)
+		sum += (int64_t)p[i] * p[i];
+	return sum;
+}
+
+#endif // CACHE_DEMO_NEON
+
+} // namespace kernels
+
+// Picks the widest kernel this CPU supports.
+inline SumSquaresKernel bestSumSquaresKernel()
+{
+#ifdef CACHE_DEMO_X86
+	if (kernels::haveAVX512())
+		return kernels::sumSquaresAVX512;
+	if (kernels::haveAVX2())
+		return kernels::sumSquaresAVX2;
+	return kernels::sumSquaresSSE2;
+#elif defined(CACHE_DEMO_NEON)
+	return kernels::sumSquaresNEON;
+#else
+	return kernels::sumSquaresScalar;
+#endif
+}
+
+// The contiguous pattern, but with the sum of squares done by the given kernel
+// (or, if it's null, the best one for this CPU).
+template <SumSquaresKernel K>
+class SumSquaresPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		kernel = K != nullptr ? K : bestSumSquaresKernel();
+	}
+
+	size_t size() const override { return data->size(); }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		return kernel(data->data() + first, last - first);
+	}
+
+private:
+	const DataSet* data = nullptr;
+	SumSquaresKernel kernel = nullptr;
+};
+
+inline const RegisterPattern<SumSquaresPattern<kernels::sumSquaresScalar>> registerScalar(
+	"contiguous-scalar", "Contiguous, one element at a time (no auto-vectorization)");
+
+inline const RegisterPattern<SumSquaresPattern<nullptr>> registerDispatched(
+	"contiguous-simd", "Contiguous, with the widest SIMD kernel this CPU supports");
+
+#ifdef CACHE_DEMO_X86
+inline const RegisterPattern<SumSquaresPattern<kernels::sumSquaresSSE2>> registerSSE2(
+	"contiguous-sse2", "Contiguous, with an SSE2 kernel");
+
+inline const RegisterPattern<SumSquaresPattern<kernels::sumSquaresAVX2>> registerAVX2(
+	"contiguous-avx2", "Contiguous, with an AVX2 kernel", kernels::haveAVX2);
+
+inline const RegisterPattern<SumSquaresPattern<kernels::sumSquaresAVX512>> registerAVX512(
+	"contiguous-avx512", "Contiguous, with an AVX-512 kernel", kernels::haveAVX512);
+#endif
+
+#ifdef CACHE_DEMO_NEON
+inline const RegisterPattern<SumSquaresPattern<kernels::sumSquaresNEON>> registerNEON(
+	"contiguous-neon", "Contiguous, with a NEON kernel");
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Summary statistics over a set of timing samples.
+// All times are in nanoseconds.
+struct Summary {
+	size_t count = 0; // Samples the statistics were computed from
+	size_t outliers = 0; // Samples outside the Tukey fences (see below)
+	bool outliersRejected = false; // Whether the outliers were excluded from count
+
+	double min = 0;
+	double median = 0;
+	double p90 = 0;
+	double p99 = 0;
+	double max = 0;
+
+	double mean = 0;
+	double stddev = 0;
+	// Half the width of the 95% confidence interval of the mean,
+	// i.e., we're 95% sure the true mean lies in mean ± ci95.
+	double ci95 = 0;
+};
+
+// Returns the pth percentile (0 <= p <= 1) of the sorted samples,
+// interpolating linearly between the two closest ranks.
+inline double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+
+	const double rank = p * (sorted.size() - 1);
+	const size_t lower = (size_t)rank;
+	const size_t upper = std::min(lower + 1, sorted.size() - 1);
+	const double frac = rank - lower;
+	return sorted[lower] + (sorted[upper] - sorted[lower]) * frac;
+}
+
+// Two-sided 95% critical value of Student's t-distribution
+// with the given degrees of freedom.
+// Past 30 the normal approximation is close enough.
+inline double tCritical95(size_t degreesOfFreedom)
+{
+	static const double table[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if (degreesOfFreedom == 0)
+		return 0;
+	if (degreesOfFreedom <= sizeof(table) / sizeof(table[0]))
+		return table[degreesOfFreedom - 1];
+	return 1.960;
+}
+
+// Computes summary statistics for the given samples.
+// The samples are sorted in place.
+//
+// Outliers are anything more than 1.5 interquartile ranges outside the
+// middle 50% of the samples (Tukey's fences). They are always counted,
+// so that a stray page fault or context switch doesn't go unnoticed,
+// and are thrown out entirely if rejectOutliers is set.
+inline Summary summarize(std::vector<double>& samples, bool rejectOutliers)
+{
+	Summary s;
+	if (samples.empty())
+		return s;
+
+	std::sort(samples.begin(), samples.end());
+
+	const double q1 = percentile(samples, 0.25);
+	const double q3 = percentile(samples, 0.75);
+	const double iqr = q3 - q1;
+	const double lowFence = q1 - 1.5 * iqr;
+	const double highFence = q3 + 1.5 * iqr;
+
+	// Since the samples are sorted, the ones we keep are a contiguous range.
+	auto first = std::lower_bound(samples.begin(), samples.end(), lowFence);
+	auto last = std::upper_bound(first, samples.end(), highFence);
+	s.outliers = (samples.end() - samples.begin()) - (last - first);
+
+	if (rejectOutliers && s.outliers > 0) {
+		samples.erase(last, samples.end());
+		samples.erase(samples.begin(), first);
+		s.outliersRejected = true;
+	}
+
+	s.count = samples.size();
+	s.min = samples.front();
+	s.median = percentile(samples, 0.5);
+	s.p90 = percentile(samples, 0.9);
+	s.p99 = percentile(samples, 0.99);
+	s.max = samples.back();
+
+	double sum = 0;
+	for (double d : samples)
+		sum += d;
+	s.mean = sum / s.count;
+
+	if (s.count > 1) {
+		double squares = 0;
+		for (double d : samples)
+			squares += (d - s.mean) * (d - s.mean);
+		// Sample (not population) standard deviation
+		s.stddev = std::sqrt(squares / (s.count - 1));
+		s.ci95 = tCritical95(s.count - 1) * s.stddev / std::sqrt((double)s.count);
+	}
+
+	return s;
+}
+
+// Formats a time in nanoseconds with whatever unit makes it readable,
+// e.g., "17.812 ms"
+inline std::string formatTime(double ns)
+{
+	const char* unit = "ns";
+	double t = ns;
+	if (std::fabs(ns) >= 1e9) {
+		t = ns / 1e9;
+		unit = "s";
+	}
+	else if (std::fabs(ns) >= 1e6) {
+		t = ns / 1e6;
+		unit = "ms";
+	}
+	else if (std::fabs(ns) >= 1e3) {
+		t = ns / 1e3;
+		unit = "us";
+	}
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.3f %s", t, unit);
+	return buf;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // For _mm_pause
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "cpus.hpp"
+#include "patterns.hpp"
+
+// Running a pattern on several threads at once, each pinned to its own CPU,
+// so we can see how throughput scales (or doesn't!) as we add cores
+// and start fighting over memory bandwidth.
+
+// Hints to the CPU that we're busy-waiting
+// (and, on SMT cores, lets the sibling thread have the core).
+// If we've been spinning for a while, we probably have more threads than CPUs,
+// so give up our time slice instead of burning it.
+inline void spinPause(unsigned int& spins)
+{
+	if (++spins % 1024 == 0) {
+		std::this_thread::yield();
+		return;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#endif
+}
+
+// Which member of the team that's running the calling thread is
+// (see ThreadTeam below), for patterns that give each thread something of its own.
+// It's 0 for the team's calling thread, and for any thread that isn't in one.
+inline size_t& teamMember()
+{
+	thread_local size_t member = 0;
+	return member;
+}
+
+// A team of threads that split each pattern's walk between them.
+//
+// The calling thread is the first member of the team,
+// and the rest are started once, up front, and spin until there's work,
+// so that thread creation and wakeup latency stay out of our timings.
+class ThreadTeam {
+public:
+	// Creates a team of the given size. If cpus isn't empty, member i
+	// (including the calling thread, as member 0) is pinned to cpus[i],
+	// and the calling thread is unpinned again when the team is destroyed.
+	ThreadTeam(size_t size, const std::vector<int>& cpus) :
+		partials(size)
+	{
+#ifdef __linux__
+		if (!cpus.empty()) {
+			pinned = sched_getaffinity(0, sizeof(originalAffinity), &originalAffinity) == 0;
+			pinThisThread(cpus[0]);
+		}
+#endif
+		for (size_t i = 1; i < size; ++i) {
+			const int cpu = i < cpus.size() ? cpus[i] : -1;
+			workers.emplace_back([this, i, cpu] { work(i, cpu); });
+		}
+	}
+
+	~ThreadTeam()
+	{
+		stopping.store(true, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_release);
+		for (auto& w : workers)
+			w.join();
+#ifdef __linux__
+		if (pinned)
+			sched_setaffinity(0, sizeof(originalAffinity), &originalAffinity);
+#endif
+	}
+
+	ThreadTeam(const ThreadTeam&) = delete;
+	ThreadTeam& operator=(const ThreadTeam&) = delete;
+
+	size_t size() const { return partials.size(); }
+
+	// Does the pattern's work, split evenly between every member of the team.
+	// With just one member, this is exactly the pattern's own doWork().
+	int run(const AccessPattern& pattern)
+	{
+		if (size() == 1)
+			return pattern.doWork();
+
+		job = &pattern;
+		remaining.store(workers.size(), std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_release);
+
+		doChunk(0);
+
+		unsigned int spins = 0;
+		while (remaining.load(std::memory_order_acquire) != 0)
+			spinPause(spins);
+
+		uint64_t sum = 0;
+		for (const auto& p : partials)
+			sum += p.sum;
+		return (int)(sum / pattern.size());
+	}
+
+private:
+	// Each thread's partial sum gets its own cache line...
+	// well, its own pair of them, since Intel's spatial prefetcher
+	// likes to pull in lines two at a time.
+	// Otherwise the threads would fight over the line as they finish up.
+	struct alignas(128) PaddedSum {
+		uint64_t sum = 0;
+	};
+
+	std::vector<PaddedSum> partials;
+	std::vector<std::thread> workers;
+
+	const AccessPattern* job = nullptr;
+	std::atomic<uint64_t> generation{0}; // Bumped to hand out a new job
+	std::atomic<size_t> remaining{0}; // Workers still busy with the current job
+	std::atomic<bool> stopping{false};
+
+#ifdef __linux__
+	cpu_set_t originalAffinity;
+	bool pinned = false;
+#endif
+
+	// Does member i's share of the current job.
+	// Chunks are rounded to a multiple of 16 elements so that (for the contiguous
+	// patterns, at least) no two threads read from the same cache line.
+	void doChunk(size_t i)
+	{
+		const size_t n = job->size();
+		size_t chunk = (n + size() - 1) / size();
+		chunk = (chunk + 15) & ~(size_t)15;
+		const size_t first = std::min(n, i * chunk);
+		const size_t last = std::min(n, first + chunk);
+		partials[i].sum = job->sumRange(first, last);
+	}
+
+	void work(size_t i, int cpu)
+	{
+		if (cpu >= 0)
+			pinThisThread(cpu);
+		teamMember() = i;
+
+		uint64_t seen = 0;
+		for (;;) {
+			uint64_t g;
+			unsigned int spins = 0;
+			while ((g = generation.load(std::memory_order_acquire)) == seen)
+				spinPause(spins);
+			seen = g;
+
+			if (stopping.load(std::memory_order_relaxed))
+				return;
+
+			doChunk(i);
+			remaining.fetch_sub(1, std::memory_order_release);
+		}
+	}
+};
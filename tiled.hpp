@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "patterns.hpp"
+#include "threads.hpp"
+
+// Getting locality back: radix partitioning shuffled pointers into tiles.
+//
+// The shuffled-indirect walk misses on nearly every load, because consecutive
+// pointers point all over the data set. If the order we visit them in
+// doesn't matter (as with a batch of lookups, or a hash join's probes),
+// we can first partition the pointers by address, into tiles that each cover
+// a cache-sized slice of the data set, and then walk the tiles one at a time.
+// Within a tile, the loads are still in random order, but they're all to
+// memory that's already in cache by the time we come back to it.
+//
+// Partitioning is a radix sort's single pass: count how many pointers land
+// in each tile, work out where each tile starts, then scatter the pointers
+// there. That's two sequential (prefetchable) passes over the pointers,
+// and scattered writes to one spot per tile, so it only pays off
+// once the data set is too big for the random walk to stay in cache.
+// To find where it does, compare shuffled-indirect against
+// shuffled-partition-walk with --sweep:
+//
+// - shuffled-tiled walks pointers partitioned (untimed) in prepare():
+//   the best case, if the partitioning was free.
+// - shuffled-partition just partitions them, which is what it costs.
+// - shuffled-partition-walk does both, and is the real alternative
+//   to the shuffled walk.
+//
+// Tiles are a power of two elements, at most --tile-size bytes (by default,
+// half of L2). With many more tiles than the TLB or the caches have room for
+// (data sets of gigabytes, with the default size), the scatter starts missing too,
+// which is when real implementations partition in two passes instead of one.
+
+namespace detail {
+
+// Partitions in[0, n) into out[0, n) by which tile, (p - base) >> shift,
+// each one points into, keeping them in order within each tile.
+// Counts is scratch space for the tiles' counts, one per tile.
+inline void partitionByAddress(int* const* in, int** out, size_t n, const int* base,
+                               unsigned int shift, PagedVector<size_t>& counts)
+{
+	std::fill(counts.begin(), counts.end(), 0);
+	for (size_t i = 0; i < n; ++i)
+		++counts[(size_t)(in[i] - base) >> shift];
+
+	size_t start = 0;
+	for (auto& c : counts) {
+		const size_t count = c;
+		c = start;
+		start += count;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+		out[counts[(size_t)(in[i] - base) >> shift]++] = in[i];
+}
+
+} // namespace detail
+
+// Which parts of partition-then-walk a tiled pattern times
+enum class TiledStep {
+	Walk, // Just the walk; partition in prepare()
+	Partition, // Just the partitioning
+	Both, // Partitioning, then the walk
+};
+
+template <TiledStep Step>
+class TiledPattern : public ShuffledPattern {
+public:
+	explicit TiledPattern(const PatternParams& params) : counts(params.threads)
+	{
+		const size_t tileElements = std::max<size_t>(params.tileSize / sizeof(int), 1);
+		while (((size_t)2 << shift) <= tileElements)
+			++shift;
+	}
+
+	void setup(DataSet& d) override
+	{
+		ShuffledPattern::setup(d);
+		tiled.resize(pointers.size());
+		tiles = ((d.size() - 1) >> shift) + 1;
+		for (auto& c : counts)
+			c.assign(tiles, 0);
+	}
+
+	void prepare(std::default_random_engine& re) override
+	{
+		ShuffledPattern::prepare(re);
+		if (Step == TiledStep::Walk)
+			detail::partitionByAddress(pointers.data(), tiled.data(), pointers.size(), base, shift, counts[0]);
+	}
+
+	// Each thread partitions its own share of the pointers, into the same share
+	// of the tiled array, with counts of its own, so they don't need to coordinate.
+	// (It's const, since only the order of the tiled pointers changes,
+	// and nothing else depends on it.)
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		int** t = const_cast<int**>(tiled.data());
+		if (Step != TiledStep::Walk) {
+			detail::partitionByAddress(pointers.data() + first, t + first, last - first, base, shift,
+			                           counts[teamMember()]);
+			if (Step == TiledStep::Partition)
+				return last - first;
+		}
+
+		uint64_t sum = 0;
+		for (size_t i = first; i < last; ++i) {
+			const int64_t d = *t[i];
+			sum += d * d;
+		}
+		return sum;
+	}
+
+	// Partitioning reads each pointer twice and writes it once.
+	double bytesPerElement() const override
+	{
+		const double partition = 3 * sizeof(int*);
+		const double walk = sizeof(int) + sizeof(int*);
+		switch (Step) {
+			case TiledStep::Walk: return walk;
+			case TiledStep::Partition: return partition;
+			default: return partition + walk;
+		}
+	}
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		ShuffledPattern::auxiliaryMemory(regions);
+		regions.push_back({tiled.data(), tiled.size() * sizeof(int*)});
+		if (Step != TiledStep::Walk) {
+			for (const auto& c : counts)
+				regions.push_back({c.data(), c.size() * sizeof(size_t)});
+		}
+	}
+
+private:
+	unsigned int shift = 0; // Tiles are 2^shift elements
+	size_t tiles = 0;
+	PagedVector<int*> tiled;
+	// Scratch space for partitioning: one set of counts per thread, indexed by
+	// teamMember(), made up front so that the timed calls don't allocate them
+	mutable std::vector<PagedVector<size_t>> counts;
+};
+
+inline const RegisterPattern<TiledPattern<TiledStep::Walk>> registerTiled(
+	"shuffled-tiled", "Shuffled-indirect, with the pointers partitioned into cache-sized tiles");
+inline const RegisterPattern<TiledPattern<TiledStep::Partition>> registerPartition(
+	"shuffled-partition", "Just partition the shuffled pointers into tiles (what tiling costs)");
+inline const RegisterPattern<TiledPattern<TiledStep::Both>> registerPartitionWalk(
+	"shuffled-partition-walk", "Partition the shuffled pointers, then walk the tiles");
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h> // For __rdtsc and __rdtscp
+#endif
+
+// The clock we time runs with.
+//
+// Where we can, that's the CPU's timestamp counter (TSC), which ticks at a
+// constant rate (regardless of the core's clock speed, on anything from the
+// last fifteen years) and costs a couple dozen cycles to read,
+// compared to the system call (or at best, vDSO call) a std::chrono clock makes.
+// We fence either side of it so that the loads we're timing can't be reordered
+// around it. Everywhere else, we use steady_clock, which (unlike
+// high_resolution_clock) is guaranteed never to go backwards.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CACHE_DEMO_TSC
+#endif
+
+namespace detail {
+
+#ifdef CACHE_DEMO_TSC
+
+// We need rdtscp, and a TSC that doesn't change speed with the core's clock
+// or stop in deep sleep states.
+inline bool haveInvariantTSC()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || (edx & (1u << 27)) == 0)
+		return false;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (edx & (1u << 8)) != 0;
+}
+
+// lfence waits for every earlier instruction to finish first,
+// so nothing before the start of a timed region leaks into it...
+inline uint64_t readTSCStart()
+{
+	_mm_lfence();
+	const uint64_t t = __rdtsc();
+	_mm_lfence();
+	return t;
+}
+
+// ...and rdtscp waits for everything before it (the work we're timing),
+// with the lfence keeping anything after it from starting early.
+inline uint64_t readTSCStop()
+{
+	unsigned int aux;
+	const uint64_t t = __rdtscp(&aux);
+	_mm_lfence();
+	return t;
+}
+
+#endif // CACHE_DEMO_TSC
+
+inline uint64_t steadyNanoseconds()
+{
+	using namespace std::chrono;
+	return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace detail
+
+class Timer {
+public:
+	// Picks the TSC if it's usable, calibrating it against steady_clock,
+	// and measures the resolution of whichever one we end up with.
+	Timer()
+	{
+#ifdef CACHE_DEMO_TSC
+		if (detail::haveInvariantTSC()) {
+			useTSC = true;
+			// Count ticks over 20 ms or so of wall time.
+			// That's plenty to get the frequency to a few parts per million.
+			const uint64_t wallStart = detail::steadyNanoseconds();
+			const uint64_t tscStart = detail::readTSCStart();
+			uint64_t wallEnd;
+			do {
+				wallEnd = detail::steadyNanoseconds();
+			} while (wallEnd - wallStart < 20 * 1000 * 1000);
+			const uint64_t tscEnd = detail::readTSCStop();
+			nsPerTick = (double)(wallEnd - wallStart) / (double)(tscEnd - tscStart);
+		}
+#endif
+
+		// The smallest difference we can see between two readings,
+		// which includes what it costs to take them.
+		uint64_t smallest = UINT64_MAX;
+		for (int i = 0; i < 1000; ++i) {
+			const uint64_t a = start();
+			uint64_t b;
+			while ((b = stop()) == a) { }
+			smallest = std::min(smallest, b - a);
+		}
+		resolution = nanoseconds(smallest);
+	}
+
+	// "tsc" or "steady_clock"
+	const char* name() const { return useTSC ? "tsc" : "steady_clock"; }
+
+	// How long a tick is, in nanoseconds
+	double tickLength() const { return nsPerTick; }
+
+	// The shortest time we can measure, in nanoseconds.
+	// Anything much less than a hundred or so of these is mostly noise.
+	double resolutionNs() const { return resolution; }
+
+	// Take a reading at the start of a timed region...
+	uint64_t start() const
+	{
+#ifdef CACHE_DEMO_TSC
+		if (useTSC)
+			return detail::readTSCStart();
+#endif
+		return detail::steadyNanoseconds();
+	}
+
+	// ...and at the end
+	uint64_t stop() const
+	{
+#ifdef CACHE_DEMO_TSC
+		if (useTSC)
+			return detail::readTSCStop();
+#endif
+		return detail::steadyNanoseconds();
+	}
+
+	// Converts the difference between two readings to nanoseconds
+	double nanoseconds(uint64_t ticks) const { return ticks * nsPerTick; }
+
+private:
+	bool useTSC = false;
+	double nsPerTick = 1;
+	double resolution = 1;
+};
+
+// The timer everything shares, calibrated on first use
+inline const Timer& timer()
+{
+	static const Timer t;
+	return t;
+}
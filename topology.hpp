@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h> // For sysconf
+
+// One level of the CPU's cache hierarchy
+struct CacheLevel {
+	int level = 0; // 1 for L1, 2 for L2, and so on
+	std::string type; // "Data", "Instruction", or "Unified"
+	size_t size = 0; // In bytes
+	size_t lineSize = 0; // In bytes
+	unsigned int sharedBy = 1; // How many logical CPUs share this cache
+
+	// Whether this cache holds data (as opposed to just instructions)
+	bool holdsData() const { return type != "Instruction"; }
+};
+
+// The caches seen by the CPU we're running on,
+// along with where we got the information from.
+struct CacheTopology {
+	std::vector<CacheLevel> levels; // Sorted by level
+	const char* source = "defaults";
+
+	// Returns the data (or unified) cache at the given level,
+	// or null if there isn't one.
+	const CacheLevel* dataCache(int level) const
+	{
+		for (const auto& c : levels) {
+			if (c.level == level && c.holdsData())
+				return &c;
+		}
+		return nullptr;
+	}
+
+	// The size of the last (biggest) level of cache
+	size_t lastLevelSize() const
+	{
+		size_t ret = 0;
+		for (const auto& c : levels) {
+			if (c.holdsData())
+				ret = std::max(ret, c.size);
+		}
+		return ret;
+	}
+
+	// The total size of all data caches.
+	// Some CPUs (many AMD ones, for example) have exclusive or
+	// non-inclusive caches, where a line can live in L2 without
+	// also living in L3. To make sure we've evicted everything,
+	// we need to push through enough memory to fill all of them.
+	size_t totalDataSize() const
+	{
+		size_t ret = 0;
+		for (const auto& c : levels) {
+			if (c.holdsData())
+				ret += c.size;
+		}
+		return ret;
+	}
+
+	// The cache line size, which is the same for every level
+	// on any CPU we care about.
+	size_t lineSize() const
+	{
+		for (const auto& c : levels) {
+			if (c.lineSize != 0)
+				return c.lineSize;
+		}
+		return 64;
+	}
+};
+
+namespace detail {
+
+inline bool readFile(const std::string& path, std::string& contents)
+{
+	std::ifstream in(path);
+	if (!in)
+		return false;
+	std::getline(in, contents);
+	return true;
+}
+
+// Parses sysfs sizes like "48K" or "105M"
+inline size_t parseCacheSize(const std::string& s)
+{
+	size_t end = 0;
+	size_t n;
+	try {
+		n = std::stoul(s, &end);
+	}
+	catch (const std::logic_error&) {
+		return 0;
+	}
+	if (end < s.size()) {
+		switch (s[end]) {
+			case 'K': n *= 1024; break;
+			case 'M': n *= 1024 * 1024; break;
+			case 'G': n *= 1024 * 1024 * 1024; break;
+		}
+	}
+	return n;
+}
+
+// Parses a sysfs CPU (or node) list like "0-3,8-11"
+inline std::vector<int> parseCPUList(const std::string& list)
+{
+	std::vector<int> ret;
+	std::istringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		const size_t dash = range.find('-');
+		try {
+			if (dash == std::string::npos) {
+				ret.push_back(std::stoi(range));
+			}
+			else {
+				const int last = std::stoi(range.substr(dash + 1));
+				for (int i = std::stoi(range.substr(0, dash)); i <= last; ++i)
+					ret.push_back(i);
+			}
+		}
+		catch (const std::logic_error&) {
+			// Ignore junk
+		}
+	}
+	return ret;
+}
+
+// Counts the CPUs in a sysfs CPU list
+inline unsigned int countCPUList(const std::string& list)
+{
+	return std::max((unsigned int)parseCPUList(list).size(), 1u);
+}
+
+// Fills in the topology from Linux's sysfs, which is the most complete
+// source we have (it's the only one that tells us about sharing).
+inline bool detectFromSysfs(CacheTopology& topo)
+{
+	for (int i = 0; ; ++i) {
+		const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(i) + "/";
+		std::string level, type, size, line, shared;
+		if (!readFile(dir + "level", level) || !readFile(dir + "type", type) ||
+		    !readFile(dir + "size", size))
+			break;
+
+		CacheLevel c;
+		c.level = std::atoi(level.c_str());
+		c.type = type;
+		c.size = parseCacheSize(size);
+		if (readFile(dir + "coherency_line_size", line))
+			c.lineSize = parseCacheSize(line);
+		if (readFile(dir + "shared_cpu_list", shared))
+			c.sharedBy = countCPUList(shared);
+		if (c.size != 0)
+			topo.levels.push_back(c);
+	}
+
+	if (topo.levels.empty())
+		return false;
+	topo.source = "sysfs";
+	return true;
+}
+
+// Fills in the topology from sysconf(), which glibc implements
+// with CPUID on x86. It doesn't know about sharing.
+inline bool detectFromSysconf(CacheTopology& topo)
+{
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+	const struct {
+		int level;
+		const char* type;
+		int size;
+		int line;
+	} queries[] = {
+		{ 1, "Data", _SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL1_DCACHE_LINESIZE },
+		{ 1, "Instruction", _SC_LEVEL1_ICACHE_SIZE, _SC_LEVEL1_ICACHE_LINESIZE },
+		{ 2, "Unified", _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL2_CACHE_LINESIZE },
+		{ 3, "Unified", _SC_LEVEL3_CACHE_SIZE, _SC_LEVEL3_CACHE_LINESIZE },
+		{ 4, "Unified", _SC_LEVEL4_CACHE_SIZE, _SC_LEVEL4_CACHE_LINESIZE },
+	};
+
+	for (const auto& q : queries) {
+		const long size = sysconf(q.size);
+		if (size <= 0)
+			continue;
+		CacheLevel c;
+		c.level = q.level;
+		c.type = q.type;
+		c.size = (size_t)size;
+		c.lineSize = (size_t)std::max(sysconf(q.line), 0L);
+		topo.levels.push_back(c);
+	}
+
+	if (topo.levels.empty())
+		return false;
+	topo.source = "sysconf";
+	return true;
+#else
+	(void)topo;
+	return false;
+#endif
+}
+
+} // namespace detail
+
+// Works out the cache hierarchy of the CPU we're running on.
+// If we can't find out anything, assume a modest desktop:
+// 32K L1d, 256K L2, 8M L3, all with 64 byte lines.
+inline CacheTopology detectCacheTopology()
+{
+	CacheTopology topo;
+	if (!detail::detectFromSysfs(topo) && !detail::detectFromSysconf(topo)) {
+		topo.levels = {
+			{ 1, "Data", 32 * 1024, 64, 1 },
+			{ 2, "Unified", 256 * 1024, 64, 1 },
+			{ 3, "Unified", 8 * 1024 * 1024, 64, 1 },
+		};
+	}
+
+	std::stable_sort(topo.levels.begin(), topo.levels.end(),
+		[](const CacheLevel& a, const CacheLevel& b) { return a.level < b.level; });
+	return topo;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "patterns.hpp"
+
+// The contiguous walk over other element types, and with a stride.
+//
+// A cache line holds 64 int8s, but only 8 doubles, so narrower columns
+// get more elements out of every line we wait for. And a walk that uses
+// every kth element still pays for the whole line, so past a stride of
+// a line's worth of elements, every access is a miss of its own.
+//
+// Like the record layouts (see layout.hpp), each of these keeps its own copy
+// of the data set, converted to its element type before each run,
+// in about as much memory as the data set itself. That makes them comparable
+// per byte of memory; compare them per element with --sweep.
+
+namespace kernels {
+
+// Sums the squares of p[0], p[stride], ... p[(n - 1) * stride].
+// Stride is a template parameter so that each instantiation gets its own loop,
+// with the step baked into its addressing, for the compiler to unroll and
+// (at stride 1) vectorize. Everything is squared in 64 bits
+// (or as a double, for floating point types), so nothing overflows.
+template <typename T, size_t Stride>
+uint64_t sumSquaresStrided(const T* p, size_t n)
+{
+	using Wide = typename std::conditional<std::is_floating_point<T>::value, double, int64_t>::type;
+	Wide sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const Wide v = p[i * Stride];
+		sum += v * v;
+	}
+	return (uint64_t)sum;
+}
+
+// The same, for strides we don't have an instantiation for
+template <typename T>
+uint64_t sumSquaresStrided(const T* p, size_t n, size_t stride)
+{
+	int64_t sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const int64_t v = p[i * stride];
+		sum += v * v;
+	}
+	return (uint64_t)sum;
+}
+
+} // namespace kernels
+
+// Walks every Stride-th element of an array of Ts
+// that takes up about as much memory as the data set.
+template <typename T, size_t Stride>
+class TypedPattern : public AccessPattern {
+public:
+	void setup(DataSet& d) override
+	{
+		data = &d;
+		values.resize(std::max<size_t>(1, d.size() * sizeof(int) / sizeof(T)));
+	}
+
+	// The data set's values are small enough to fit in any of our types.
+	// There are more Ts than ints for the narrower types,
+	// so those go around the data set again.
+	void prepare(std::default_random_engine&) override
+	{
+		const size_t n = data->size();
+		for (size_t i = 0; i < values.size(); ++i)
+			values[i] = (T)(*data)[i % n];
+	}
+
+	size_t size() const override { return (values.size() + Stride - 1) / Stride; }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		return kernels::sumSquaresStrided<T, Stride>(values.data() + first * Stride, last - first);
+	}
+
+	// We read a whole line for every element once they're a line or more apart.
+	double bytesPerElement() const override { return (double)std::min<size_t>(sizeof(T) * Stride, 64); }
+
+	void auxiliaryMemory(std::vector<MemoryRegion>& regions) const override
+	{
+		regions.push_back({values.data(), values.size() * sizeof(T)});
+	}
+
+protected:
+	const T* elements() const { return values.data(); }
+
+private:
+	const DataSet* data = nullptr;
+	PagedVector<T> values;
+};
+
+// The int32 walk with the stride from --stride,
+// dispatched to a TypedPattern kernel when there is one for it.
+class StridedPattern : public TypedPattern<int32_t, 1> {
+public:
+	explicit StridedPattern(const PatternParams& params) :
+		stride(params.stride)
+	{
+		if (stride == 0)
+			throw std::invalid_argument("The stride must be at least 1");
+	}
+
+	size_t size() const override { return (TypedPattern::size() + stride - 1) / stride; }
+
+	uint64_t sumRange(size_t first, size_t last) const override
+	{
+		const int32_t* p = elements() + first * stride;
+		const size_t n = last - first;
+		switch (stride) {
+			case 1: return kernels::sumSquaresStrided<int32_t, 1>(p, n);
+			case 2: return kernels::sumSquaresStrided<int32_t, 2>(p, n);
+			case 4: return kernels::sumSquaresStrided<int32_t, 4>(p, n);
+			case 8: return kernels::sumSquaresStrided<int32_t, 8>(p, n);
+			case 16: return kernels::sumSquaresStrided<int32_t, 16>(p, n);
+			case 32: return kernels::sumSquaresStrided<int32_t, 32>(p, n);
+			case 64: return kernels::sumSquaresStrided<int32_t, 64>(p, n);
+			default: return kernels::sumSquaresStrided<int32_t>(p, n, stride);
+		}
+	}
+
+	double bytesPerElement() const override { return (double)std::min<size_t>(sizeof(int32_t) * stride, 64); }
+
+private:
+	size_t stride;
+};
+
+inline const RegisterPattern<TypedPattern<int8_t, 1>> registerInt8(
+	"contiguous-int8", "Contiguous, over int8s");
+inline const RegisterPattern<TypedPattern<int16_t, 1>> registerInt16(
+	"contiguous-int16", "Contiguous, over int16s");
+inline const RegisterPattern<TypedPattern<int32_t, 1>> registerInt32(
+	"contiguous-int32", "Contiguous, over int32s (squared in 64 bits)");
+inline const RegisterPattern<TypedPattern<int64_t, 1>> registerInt64(
+	"contiguous-int64", "Contiguous, over int64s");
+inline const RegisterPattern<TypedPattern<float, 1>> registerFloat(
+	"contiguous-float", "Contiguous, over floats (summed as doubles)");
+inline const RegisterPattern<TypedPattern<double, 1>> registerDouble(
+	"contiguous-double", "Contiguous, over doubles");
+
+inline const RegisterPattern<StridedPattern> registerStrided(
+	"strided", "Contiguous-int32, but only every --stride-th element");